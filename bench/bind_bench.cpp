@@ -0,0 +1,89 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Measures proc_mgr::bind_packets with 1 to 32 binding threads on
+// synthetic traffic between the first local IPv4 address and a set of
+// remote hosts, with the processes snapshot of the running system.
+// Usage: bind_bench [packets [batch [hosts]]]
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <ifaddrs.h>
+#include "proc.h"
+#include "settings.h"
+
+int main(int argc, char** argv) {
+	const size_t	n_pkts = (argc > 1) ? std::atol(argv[1]) : 2000000,
+			batch = (argc > 2) ? std::atol(argv[2]) : 65536,
+			n_hosts = (argc > 3) ? std::atol(argv[3]) : 20000;
+	// no need for the netlink thread, the addresses are read once
+	static volatile bool		quit = true;
+	nettop::local_addr_mgr		lam(quit);
+	in_addr				local = { 0 };
+	struct ifaddrs			*ifa = 0;
+	if(getifaddrs(&ifa))
+		return 1;
+	for(struct ifaddrs *p = ifa; p; p = p->ifa_next) {
+		if(!p->ifa_addr || AF_INET != p->ifa_addr->sa_family)
+			continue;
+		local = ((sockaddr_in*)p->ifa_addr)->sin_addr;
+		if(local.s_addr != htonl(INADDR_LOOPBACK))
+			break;
+	}
+	freeifaddrs(ifa);
+	std::vector<nettop::packet_stats>	pkts;
+	pkts.reserve(n_pkts);
+	std::srand(1);
+	for(size_t i = 0; i < n_pkts; ++i) {
+		in_addr		r;
+		r.s_addr = htonl(0x0A000000 + std::rand()%n_hosts);
+		const bool	recv = std::rand() & 1;
+		pkts.push_back(nettop::packet_stats(recv ? addr_t(r) : addr_t(local), recv ? addr_t(local) : addr_t(r), std::rand()%65536, std::rand()%65536,
+			60 + std::rand()%1400, (i & 1) ? nettop::packet_stats::PACKET_TCP : nettop::packet_stats::PACKET_UDP, 1.0 + i));
+	}
+	// split upfront, as the binder would get them
+	std::vector<std::vector<nettop::packet_stats> >	batches;
+	for(size_t i = 0; i < n_pkts; i += batch)
+		batches.push_back(std::vector<nettop::packet_stats>(pkts.begin() + i, pkts.begin() + std::min(n_pkts, i + batch)));
+	std::printf("%zu packets, batches of %zu, %zu remote hosts\n", n_pkts, batch, n_hosts);
+	std::printf("%8s %12s %12s %10s\n", "threads", "msec", "Mpkts/s", "speedup");
+	double	base_ms = 0.0;
+	for(const size_t th : { 1, 2, 4, 8, 16, 32 }) {
+		nettop::proc_mgr			pm;
+		nettop::proc_mgr::stats			st;
+		nettop::log_flows			flows;
+		std::unique_ptr<nettop::thread_pool>	tp;
+		if(th > 1)
+			tp.reset(new nettop::thread_pool(th));
+		const std::chrono::steady_clock::time_point	start = std::chrono::steady_clock::now();
+		for(const auto& b : batches)
+			pm.bind_packets(b, lam, st, &flows, 0, tp.get());
+		pm.bind_unmapped(st, &flows);
+		const double	ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if(1 == th)
+			base_ms = ms;
+		std::printf("%8zu %12.1f %12.2f %10.2f\n", th, ms, n_pkts/ms/1000.0, base_ms/ms);
+	}
+	return 0;
+}
+
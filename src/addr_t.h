@@ -17,87 +17,128 @@
 *	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+
 #ifndef _ADDR_T_H_
 #define _ADDR_T_H_
 
 #include <netdb.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <stdint.h>
 #include <cstring>
 #include <string>
+#include <functional>
 
+// IPv4 and IPv6 addresses in 16 bytes, IPv4 is stored as the
+// v4-mapped ::ffff:a.b.c.d so that both families compare, hash
+// and get copied the same way
 class addr_t {
+	// the address bytes as two big endian halves in host order:
+	// comparing (hi_, lo_) is comparing the bytes
+	uint64_t	hi_,
+			lo_;
+
+	static const uint64_t	V4_MAPPED = 0x0000FFFF00000000ULL;
+
+	void set_bytes6(const unsigned char* b) {
+		uint64_t	h,
+				l;
+		std::memcpy(&h, b, sizeof(h));
+		std::memcpy(&l, b + sizeof(h), sizeof(l));
+		hi_ = be64toh(h);
+		lo_ = be64toh(l);
+	}
 
-       	typedef union {
-               	in_addr         ipv4;
-               	in6_addr        ipv6;
-       	} ip_data;
-
-       	int       af_type_;
-       	ip_data   ip_data_;
-
-       	static ip_data get_ip4_data(const void* b) {
-               	ip_data ret;
-                ret.ipv4 = *(in_addr*)b;
-               	return ret;
-       	}
-
-	static ip_data get_ip6_data(const void* b) {
-               	ip_data ret;
-		ret.ipv6 = *(in6_addr*)b;
-               	return ret;
-       	}
+	void get_bytes6(unsigned char* b) const {
+		const uint64_t	h = htobe64(hi_),
+				l = htobe64(lo_);
+		std::memcpy(b, &h, sizeof(h));
+		std::memcpy(b + sizeof(h), &l, sizeof(l));
+	}
 
+	in_addr get_ip4(void) const {
+		in_addr	ret;
+		ret.s_addr = htonl((uint32_t)lo_);
+		return ret;
+	}
 
+	in6_addr get_ip6(void) const {
+		in6_addr	ret;
+		get_bytes6(ret.s6_addr);
+		return ret;
+	}
 public:
-	addr_t() : af_type_(0) {
-		std::memset(&ip_data_, 0x00, sizeof(ip_data));
+	addr_t() : hi_(0), lo_(0) {
 	}
 
-	addr_t(const int af_type) : af_type_(af_type) {
-		std::memset(&ip_data_, 0x00, sizeof(ip_data));
-		switch(af_type_) {
-			case AF_INET:
-				ip_data_.ipv4.s_addr = INADDR_ANY;
-				break;
-			case AF_INET6:
-				ip_data_.ipv6 = IN6ADDR_ANY_INIT;
-				break;
-		}
+	// the any address of the given family
+	addr_t(const int af_type) : hi_(0), lo_((af_type == AF_INET) ? V4_MAPPED : 0) {
 	}
 
-       	addr_t(const in_addr& ipv4) : af_type_(AF_INET), ip_data_(get_ip4_data(&ipv4)) {
+       	addr_t(const in_addr& ipv4) : hi_(0), lo_(V4_MAPPED | ntohl(ipv4.s_addr)) {
 	}
 
-       	addr_t(const in6_addr& ipv6) : af_type_(AF_INET6), ip_data_(get_ip6_data(&ipv6)) {
+       	addr_t(const in6_addr& ipv6) {
+		set_bytes6(ipv6.s6_addr);
        	}
 
-       	addr_t(const addr_t& rhs) : af_type_(rhs.af_type_), ip_data_(rhs.ip_data_) {
-       	}
+	inline bool is_ipv4(void) const {
+		return !hi_ && (lo_ >> 32) == 0x0000FFFF;
+	}
+
+	inline bool is_ipv6(void) const {
+		return !is_ipv4();
+	}
 
 	int get_af_type(void) const {
-		return af_type_;
+		return is_ipv4() ? AF_INET : AF_INET6;
 	}
 
-	addr_t& operator=(const addr_t& rhs) {
-		if(this != &rhs) {
-			af_type_ = rhs.af_type_;
-			ip_data_ = rhs.ip_data_;
+	// numeric form only, without going through getnameinfo;
+	// buf has to hold INET6_ADDRSTRLEN chars, returns the length
+	size_t to_num_buf(char* buf) const {
+		if(is_ipv4()) {
+			char		*p = buf;
+			for(int i = 3; i >= 0; --i) {
+				unsigned int	o = (lo_ >> (8*i)) & 0xFF;
+				if(o >= 100) {
+					*p++ = '0' + o/100;
+					o %= 100;
+					*p++ = '0' + o/10;
+				} else if(o >= 10) {
+					*p++ = '0' + o/10;
+				}
+				*p++ = '0' + o%10;
+				if(i)
+					*p++ = '.';
+			}
+			*p = '\0';
+			return p - buf;
 		}
-		return *this;
+		const in6_addr	ip6 = get_ip6();
+		if(!inet_ntop(AF_INET6, &ip6, buf, INET6_ADDRSTRLEN))
+			return 0;
+		return std::strlen(buf);
 	}
 
-	inline bool is_ipv6(void) const {
-		return af_type_ == AF_INET6;
+	std::string to_num_str(void) const {
+		char		buf[INET6_ADDRSTRLEN];
+		const size_t	len = to_num_buf(buf);
+		if(!len)
+			return "<invalid host>";
+		return std::string(buf, len);
 	}
 
 	std::string to_str(const bool full_name = false, const int rec_calls = 0) const {
-		const int	gni_flags = (full_name) ? 0 : NI_NUMERICHOST;
-               	if(af_type_ == AF_INET) {
+		if(!full_name)
+			return to_num_str();
+               	if(is_ipv4()) {
                        	struct sockaddr_in      in;
                        	in.sin_family = AF_INET;
                        	in.sin_port = 123;
-                       	in.sin_addr = ip_data_.ipv4;
+                       	in.sin_addr = get_ip4();
                        	char                    hbuf[NI_MAXHOST];
-			if(const int rv = getnameinfo((const sockaddr*)&in, sizeof(struct sockaddr_in), hbuf, sizeof(hbuf), 0, 0, gni_flags)) {
+			if(const int rv = getnameinfo((const sockaddr*)&in, sizeof(struct sockaddr_in), hbuf, sizeof(hbuf), 0, 0, 0)) {
 				if(rec_calls > 1)
 					return "<invalid host>";
 				if(EAI_AGAIN == rv)
@@ -109,10 +150,10 @@ public:
                	in.sin6_family = AF_INET6;
                	in.sin6_port = 123;
                	in.sin6_flowinfo = 0;
-               	in.sin6_addr = ip_data_.ipv6;
+               	in.sin6_addr = get_ip6();
                	in.sin6_scope_id = 0;
                	char                    hbuf[NI_MAXHOST];
-		if(const int rv = getnameinfo((const sockaddr*)&in, sizeof(struct sockaddr_in6), hbuf, sizeof(hbuf), 0, 0, gni_flags)) {
+		if(const int rv = getnameinfo((const sockaddr*)&in, sizeof(struct sockaddr_in6), hbuf, sizeof(hbuf), 0, 0, 0)) {
 			if(rec_calls > 1)
 				return "<invalid host>";
 			if(EAI_AGAIN == rv)
@@ -121,30 +162,65 @@ public:
                	return hbuf;
        	}
 
+	// raw address bytes (16), ipv4 takes the first 4
+	void get_bytes(unsigned char* b) const {
+		if(is_ipv4()) {
+			const in_addr	ip4 = get_ip4();
+			std::memset(b, 0x00, 16);
+			std::memcpy(b, &ip4, sizeof(ip4));
+			return;
+		}
+		get_bytes6(b);
+	}
+
+	// all the 16 bytes, ipv4 as v4-mapped: from_bytes with
+	// AF_INET6 gives back the same address
+	void get_raw_bytes(unsigned char* b) const {
+		get_bytes6(b);
+	}
+
+	static addr_t from_bytes(const int af_type, const unsigned char* b) {
+		switch(af_type) {
+			case AF_INET:
+				return addr_t(*(const in_addr*)b);
+			case AF_INET6:
+				return addr_t(*(const in6_addr*)b);
+		}
+		return addr_t();
+	}
+
+	// murmur3 finalizer over both halves
+	uint64_t hash(void) const {
+		uint64_t	h = (hi_ * 0x9E3779B97F4A7C15ULL) ^ lo_;
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ULL;
+		h ^= h >> 33;
+		return h;
+	}
+
        	friend bool operator==(const addr_t& lhs, const addr_t& rhs);
 
        	friend bool operator<(const addr_t& lhs, const addr_t& rhs);
 };
 
+// both without branches
 inline bool operator==(const addr_t& lhs, const addr_t& rhs) {
-        if(lhs.af_type_ == rhs.af_type_) {
-                if(lhs.af_type_ == AF_INET) {
-                        return lhs.ip_data_.ipv4.s_addr == rhs.ip_data_.ipv4.s_addr;
-                }
-                return !std::memcmp(&lhs.ip_data_.ipv6, &rhs.ip_data_.ipv6, sizeof(in6_addr));
-        }
-        return false;
+	return !((lhs.hi_ ^ rhs.hi_) | (lhs.lo_ ^ rhs.lo_));
 }
 
 inline bool operator<(const addr_t& lhs, const addr_t& rhs) {
-        if(lhs.af_type_ == rhs.af_type_) {
-                if(lhs.af_type_ == AF_INET) {
-                        return lhs.ip_data_.ipv4.s_addr < rhs.ip_data_.ipv4.s_addr;
-                }
-                return std::memcmp(&lhs.ip_data_.ipv6, &rhs.ip_data_.ipv6, sizeof(in6_addr)) < 0;
-        }
-        return lhs.af_type_ < rhs.af_type_;
+	return (lhs.hi_ < rhs.hi_) | ((lhs.hi_ == rhs.hi_) & (lhs.lo_ < rhs.lo_));
 }
 
-#endif //_ADDR_T_H_
+namespace std {
+	template<>
+	struct hash<addr_t> {
+		size_t operator()(const addr_t& a) const {
+			return a.hash();
+		}
+	};
+}
 
+#endif //_ADDR_T_H_
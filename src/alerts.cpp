@@ -0,0 +1,189 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "alerts.h"
+#include "utils.h"
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+	// default clear level, as a fraction of the threshold
+	const double	CLEAR_FACTOR = 0.8;
+
+	class alert_evt : public nettop::async_line {
+		const std::string	line_;
+	public:
+		alert_evt(const std::string& line) : line_(line) {
+		}
+
+		virtual std::string log(nettop::name_res& nr) const {
+			return line_;
+		}
+	};
+
+	bool parse_value(const std::string& s, double& out) {
+		char		*end = 0;
+		const double	v = std::strtod(s.c_str(), &end);
+		if(end == s.c_str() || v < 0.0)
+			return false;
+		double		mult = 1.0;
+		switch(*end) {
+			case '\0':
+				break;
+			case 'k':
+			case 'K':
+				mult = 1024.0;
+				++end;
+				break;
+			case 'm':
+			case 'M':
+				mult = 1024.0*1024.0;
+				++end;
+				break;
+			case 'g':
+			case 'G':
+				mult = 1024.0*1024.0*1024.0;
+				++end;
+				break;
+			default:
+				return false;
+		}
+		// allow KiB, MiB/s and similar
+		if(*end == 'i')
+			++end;
+		if(*end == 'B')
+			++end;
+		if(!std::strcmp(end, "/s"))
+			end += 2;
+		if(*end)
+			return false;
+		out = v*mult;
+		return true;
+	}
+
+	std::string value_str(const double v, const bool rate) {
+		char	buf[64];
+		if(!rate) {
+			std::snprintf(buf, 64, "%.0f", v);
+		} else if(v >= 1024.0*1024.0*1024.0) {
+			std::snprintf(buf, 64, "%.2f GiB/s", v/(1024.0*1024.0*1024.0));
+		} else if(v >= 1024.0*1024.0) {
+			std::snprintf(buf, 64, "%.2f MiB/s", v/(1024.0*1024.0));
+		} else if(v >= 1024.0) {
+			std::snprintf(buf, 64, "%.2f KiB/s", v/1024.0);
+		} else {
+			std::snprintf(buf, 64, "%.2f B/s", v);
+		}
+		return buf;
+	}
+}
+
+nettop::alert_mgr::alert_mgr(const std::string& fname) : gen_(0) {
+	static const char*	METRICS[] = { "recv", "sent", "total", "hosts" };
+	std::ifstream	istr(fname.c_str());
+	if(!istr)
+		throw runtime_error("Can't open alert rules file \"") << fname << "\"";
+	std::string	line;
+	size_t		n_line = 0;
+	while(std::getline(istr, line)) {
+		++n_line;
+		const size_t	c_pos = line.find('#');
+		if(c_pos != std::string::npos)
+			line.resize(c_pos);
+		std::istringstream	iss(line);
+		std::string		m_s,
+					t_s,
+					opt;
+		rule			r;
+		if(!(iss >> r.name))
+			continue;
+		if(!(iss >> m_s >> t_s))
+			throw runtime_error("Incomplete alert rule in \"") << fname << "\" at line " << n_line;
+		size_t	m = 0;
+		while(m < sizeof(METRICS)/sizeof(METRICS[0]) && m_s != METRICS[m])
+			++m;
+		if(m == sizeof(METRICS)/sizeof(METRICS[0]))
+			throw runtime_error("Invalid alert metric \"") << m_s << "\" in \"" << fname << "\" at line " << n_line;
+		r.m = (metric)m;
+		if(!parse_value(t_s, r.threshold))
+			throw runtime_error("Invalid alert threshold \"") << t_s << "\" in \"" << fname << "\" at line " << n_line;
+		r.clear = CLEAR_FACTOR*r.threshold;
+		while(iss >> opt) {
+			if(!opt.compare(0, 6, "clear=")) {
+				if(!parse_value(opt.substr(6), r.clear) || r.clear > r.threshold)
+					throw runtime_error("Invalid alert clear level \"") << opt << "\" in \"" << fname << "\" at line " << n_line;
+			} else if(!opt.compare(0, 4, "cmd=")) {
+				r.cmd = opt.substr(4);
+			} else {
+				throw runtime_error("Invalid alert option \"") << opt << "\" in \"" << fname << "\" at line " << n_line;
+			}
+		}
+		rules_.push_back(r);
+	}
+}
+
+void nettop::alert_mgr::eval(const ps_vec& p_vec, async_log_list& log_list) {
+	++gen_;
+	for(auto& r : rules_) {
+		const bool	is_rate = (r.m != METRIC_HOSTS);
+		for(const auto& p : p_vec) {
+			if(!r.cmd.empty() && p.cmd.find(r.cmd) == std::string::npos)
+				continue;
+			double	v = 0.0;
+			switch(r.m) {
+				case METRIC_RECV:
+					v = p.rate_rs.first;
+					break;
+				case METRIC_SENT:
+					v = p.rate_rs.second;
+					break;
+				case METRIC_TOTAL:
+					v = p.rate_rs.first + p.rate_rs.second;
+					break;
+				case METRIC_HOSTS:
+					v = p.n_hosts;
+					break;
+			}
+			auto	it = r.active.find(p.pid);
+			if(it == r.active.end()) {
+				if(v <= r.threshold)
+					continue;
+				r.active[p.pid] = gen_;
+				log_list.push(sp_async_line(new alert_evt("ALERT " + r.name + " pid " + std::to_string(p.pid) + " (" + p.cmd + ") " + value_str(v, is_rate) + " > " + value_str(r.threshold, is_rate))));
+			} else if(v < r.clear) {
+				r.active.erase(it);
+				log_list.push(sp_async_line(new alert_evt("CLEAR " + r.name + " pid " + std::to_string(p.pid) + " (" + p.cmd + ") " + value_str(v, is_rate) + " < " + value_str(r.clear, is_rate))));
+			} else {
+				it->second = gen_;
+			}
+		}
+		// processes which went away
+		for(auto it = r.active.begin(); it != r.active.end(); ) {
+			if(it->second != gen_) {
+				log_list.push(sp_async_line(new alert_evt("CLEAR " + r.name + " pid " + std::to_string(it->first) + " exited")));
+				it = r.active.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+}
@@ -0,0 +1,68 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _ALERTS_H_
+#define _ALERTS_H_
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include "proc.h"
+#include "async_log.h"
+
+namespace nettop {
+	// Threshold rules evaluated on the processes totals at each
+	// refresh; a rule raises an alert when a process goes above
+	// its threshold and clears it only once it drops below the
+	// clear level, alerts are written through async_log
+	class alert_mgr {
+		enum metric {
+			METRIC_RECV = 0,
+			METRIC_SENT,
+			METRIC_TOTAL,
+			METRIC_HOSTS
+		};
+
+		struct rule {
+			std::string			name;
+			metric				m;
+			double				threshold,
+							clear;
+			std::string			cmd;	// only processes whose cmdline contains this
+			// processes currently over the threshold
+			// and the last evaluation they were seen at
+			std::unordered_map<pid_t, size_t>	active;
+		};
+
+		std::vector<rule>	rules_;
+		size_t			gen_;
+	public:
+		// one rule per line:
+		// 'name (recv|sent|total|hosts) threshold [clear=value] [cmd=substring]'
+		// rates thresholds are bytes/s with optional K, M or G suffix
+		// hosts is the estimated number of distinct remote addresses
+		alert_mgr(const std::string& fname);
+
+		// rates are the ones of the chosen sort window
+		void eval(const ps_vec& p_vec, async_log_list& log_list);
+	};
+}
+
+#endif //_ALERTS_H_
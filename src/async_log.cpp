@@ -19,40 +19,298 @@
 
 #include "async_log.h"
 #include <fstream>
+#include <sstream>
 #include <thread>
 #include <ctime>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <unordered_map>
+#include <sys/stat.h>
+#include "name_store.h"
 #include "utils.h"
 
+namespace {
+	const char	MAGIC[8] = { 'N', 'T', 'L', 'O', 'G', '0', '0', '2' };
+	// size of the output buffer
+	const size_t	OUT_BUF_SZ = 1024*1024;
+	// longest TEXT record
+	const size_t	MAX_TEXT = 1024;
+	// lines queued before dropping the new ones
+	const size_t	MAX_LINES = 65536;
+	// a batch is written once it has this many lines
+	const size_t	BATCH_LINES = 1024;
+	// or after waiting for this long
+	const size_t	BATCH_MSEC = 250;
+
+	std::string time_str(const std::chrono::system_clock::time_point& tp) {
+		const std::time_t	now_c = std::chrono::system_clock::to_time_t(tp);
+		const size_t		now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(tp.time_since_epoch()).count()%1000;
+		std::tm			now_tm;
+		localtime_r(&now_c, &now_tm);
+		char	tm_str[64];
+		std::strftime(tm_str, 64, "%Y-%m-%d %H:%M:%S.%%03d", &now_tm);
+		char	tm_full_str[64];
+		std::snprintf(tm_full_str, 64, tm_str, now_ms);
+		return tm_full_str;
+	}
+
+	std::chrono::system_clock::time_point ts_to_tp(const int64_t ts_us) {
+		return std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::microseconds(ts_us)));
+	}
+
+	std::string flow_str(const nettop::log_rec::type t, const uint8_t proto, const std::string& src, const uint16_t p_src, const std::string& dst, const uint16_t p_dst, const size_t pkts, const size_t bytes, const double dur) {
+		std::ostringstream	oss;
+		switch(t) {
+			case nettop::log_rec::type::UNDET:
+				oss << "UNDET  :";
+				break;
+			case nettop::log_rec::type::UNMAP_R:
+				oss << "UNMAP_R:";
+				break;
+			case nettop::log_rec::type::UNMAP_S:
+				oss << "UNMAP_S:";
+				break;
+			default:
+				break;
+		}
+		oss << src << ":" << p_src << " --> " << dst << ":" << p_dst << ((nettop::packet_stats::type::PACKET_TCP == proto) ? " tcp " : " udp ")
+		    << pkts << " pkts " << bytes << " bytes";
+		if(pkts > 1) {
+			char	buf[32];
+			std::snprintf(buf, 32, " over %.3fs", dur);
+			oss << buf;
+		}
+		return oss.str();
+	}
+
+	// flows of the text log, timed at their first packet
+	struct flow_evt : public nettop::async_line {
+		const nettop::log_flow_key	k;
+		const nettop::log_flow		f;
+
+		flow_evt(const nettop::log_flow_key& k_, const nettop::log_flow& f_) : async_line(ts_to_tp(f_.first_ts*1000000.0)), k(k_), f(f_) {
+		}
+
+		virtual std::string log(nettop::name_res& nr) const {
+			return flow_str((nettop::log_rec::type)k.t, k.proto, nr.to_str(k.src), k.p_src, nr.to_str(k.dst), k.p_dst, f.pkts, f.bytes, f.last_ts - f.first_ts);
+		}
+	};
+}
+
+void nettop::log_flows::add(const packet_stats& ps, const log_rec::type t) {
+	const log_flow_key	k = { ps.src, ps.dst, ps.p_src, ps.p_dst, (uint8_t)t, (uint8_t)ps.t };
+	const log_flow		n_f = { 0, 0, ps.ts, ps.ts };
+	log_flow&		f = flows_.insert(std::make_pair(k, n_f)).first->second;
+	++f.pkts;
+	f.bytes += ps.len;
+	f.first_ts = std::min(f.first_ts, ps.ts);
+	f.last_ts = std::max(f.last_ts, ps.ts);
+}
+
+void nettop::log_flows::merge(const log_flows& rhs) {
+	for(const auto& i : rhs.flows_) {
+		const auto	r = flows_.insert(i);
+		if(r.second)
+			continue;
+		log_flow&	f = r.first->second;
+		f.pkts += i.second.pkts;
+		f.bytes += i.second.bytes;
+		f.first_ts = std::min(f.first_ts, i.second.first_ts);
+		f.last_ts = std::max(f.last_ts, i.second.last_ts);
+	}
+}
+
+void nettop::log_flows::flush(async_log_list& log_list) {
+	struct sort_fctr {
+		bool operator()(const flow_map::value_type* lhs, const flow_map::value_type* rhs) const {
+			return lhs->second.first_ts < rhs->second.first_ts;
+		}
+	};
+	// in the order they started
+	std::vector<const flow_map::value_type*>	v;
+	v.reserve(flows_.size());
+	for(const auto& i : flows_)
+		v.push_back(&i);
+	std::sort(v.begin(), v.end(), sort_fctr());
+	for(const auto& i : v)
+		log_list.push_flow(i->first, i->second);
+	flows_.clear();
+}
+
+nettop::async_log_list::async_log_list() : mode_(NONE), lines_(MAX_LINES, bounded_queue<sp_async_line>::DROP_NEWEST), lines_dropped_(0), head_(0), tail_(0), dropped_(0) {
+}
+
+void nettop::async_log_list::set_text(void) {
+	mode_ = TEXT;
+}
+
+void nettop::async_log_list::set_binary(const size_t n_recs) {
+	size_t	n = 1024;
+	while(n < n_recs)
+		n <<= 1;
+	ring_.resize(n);
+	mode_ = BINARY;
+}
+
+nettop::log_rec* nettop::async_log_list::reserve(void) {
+	if(ring_.size() == head_ - tail_) {
+		++dropped_;
+		return 0;
+	}
+	log_rec	*ret = &ring_[head_ & (ring_.size() - 1)];
+	std::memset(ret, 0x00, sizeof(log_rec));
+	return ret;
+}
+
+void nettop::async_log_list::push(const sp_async_line& in) {
+	// rare enough to stay lines in binary mode too
+	if(NONE != mode_)
+		lines_.push(in);
+}
+
+void nettop::async_log_list::push_flow(const log_flow_key& k, const log_flow& f) {
+	if(TEXT == mode_) {
+		lines_.push(sp_async_line(new flow_evt(k, f)));
+		return;
+	}
+	if(BINARY != mode_)
+		return;
+	std::lock_guard<std::mutex>	lg(mtx_);
+	log_rec				*r = reserve();
+	if(!r)
+		return;
+	r->ts_us = (int64_t)(f.first_ts*1000000.0);
+	r->dur_us = std::min(1000000.0*(f.last_ts - f.first_ts), 4294967295.0);
+	r->pkts = std::min(f.pkts, (size_t)0xFFFFFFFF);
+	r->bytes = f.bytes;
+	r->t = k.t;
+	r->proto = k.proto;
+	r->p_src = k.p_src;
+	r->p_dst = k.p_dst;
+	k.src.get_raw_bytes(r->src);
+	k.dst.get_raw_bytes(r->dst);
+	++head_;
+}
+
+size_t nettop::async_log_list::pop_lines(std::vector<sp_async_line>& out, const size_t min_lines, const std::chrono::milliseconds& tmout) {
+	lines_.pop_many(out, min_lines, tmout);
+	const size_t	dropped = lines_.get_stats().dropped,
+			ret = dropped - lines_dropped_;
+	lines_dropped_ = dropped;
+	return ret;
+}
+
+size_t nettop::async_log_list::drain(std::vector<log_rec>& out) {
+	std::lock_guard<std::mutex>	lg(mtx_);
+	const size_t	n = head_ - tail_,
+			mask = ring_.size() - 1,
+			first = std::min(n, ring_.size() - (tail_ & mask));
+	out.resize(n);
+	if(n) {
+		std::memcpy(&out[0], &ring_[tail_ & mask], first*sizeof(log_rec));
+		std::memcpy(&out[first], &ring_[0], (n - first)*sizeof(log_rec));
+	}
+	tail_ = head_;
+	const size_t	ret = dropped_;
+	dropped_ = 0;
+	return ret;
+}
+
+void nettop::async_log::write_text(std::vector<sp_async_line>& lines, const size_t min_lines, const std::chrono::milliseconds& tmout) {
+	const size_t	dropped = list_.pop_lines(lines, min_lines, tmout);
+	for(const auto& i : lines)
+		(*ostr_) << time_str(i->get_tp()) << " " << i->log(nr_) << '\n';
+	if(dropped)
+		(*ostr_) << time_str(std::chrono::system_clock::now()) << " Dropped " << dropped << " lines, the log queue was full\n";
+	lines.clear();
+	// once per batch, not per line
+	ostr_->flush();
+}
+
+void nettop::async_log::write_text_rec(const std::chrono::system_clock::time_point& tp, const std::string& s) {
+	const size_t	len = std::min(s.size(), MAX_TEXT);
+	log_rec		r;
+	std::memset(&r, 0x00, sizeof(r));
+	r.ts_us = std::chrono::duration_cast<std::chrono::microseconds>(tp.time_since_epoch()).count();
+	r.t = log_rec::type::TEXT;
+	r.len = len;
+	ostr_->write((const char*)&r, sizeof(r));
+	ostr_->write(s.data(), len);
+	// pad to the next record
+	static const char	pad[sizeof(log_rec)] = { 0 };
+	ostr_->write(pad, (sizeof(log_rec) - len%sizeof(log_rec))%sizeof(log_rec));
+}
+
+void nettop::async_log::write_binary(std::vector<log_rec>& recs, std::vector<sp_async_line>& lines, const size_t min_lines, const std::chrono::milliseconds& tmout) {
+	// lines are waited on first, so the records
+	// include what came in meanwhile
+	const size_t	l_dropped = list_.pop_lines(lines, min_lines, tmout),
+			dropped = list_.drain(recs);
+	if(!recs.empty())
+		ostr_->write((const char*)&recs[0], recs.size()*sizeof(log_rec));
+	for(const auto& i : lines)
+		write_text_rec(i->get_tp(), i->log(nr_));
+	lines.clear();
+	if(dropped)
+		write_text_rec(std::chrono::system_clock::now(), "Dropped " + std::to_string(dropped) + " events, the log ring was full");
+	if(l_dropped)
+		write_text_rec(std::chrono::system_clock::now(), "Dropped " + std::to_string(l_dropped) + " lines, the log queue was full");
+	ostr_->flush();
+}
+
+void nettop::async_log::write_batch(std::vector<log_rec>& recs, std::vector<sp_async_line>& lines, const size_t min_lines, const std::chrono::milliseconds& tmout) {
+	if(binary_)
+		write_binary(recs, lines, min_lines, tmout);
+	else
+		write_text(lines, min_lines, tmout);
+}
+
 void nettop::async_log::thread_proc(void) {
+	// only reused, the ring never holds more
+	std::vector<log_rec>		recs;
+	std::vector<sp_async_line>	lines;
 	while(!exit_) {
-		// sleep for a bit
-		std::this_thread::sleep_for(std::chrono::milliseconds(250));
-		// get the current list
-		std::list<sp_async_line>	cur_list;
-		list_.swap(cur_list);
-		if (!*ostr_)
+		if (!*ostr_) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(BATCH_MSEC));
 			continue;
-		for(const auto& i : cur_list) {
-			const std::time_t	now_c = std::chrono::system_clock::to_time_t(i->get_tp());
-			const size_t		now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(i->get_tp().time_since_epoch()).count()%1000;
-			std::tm			now_tm;
-			localtime_r(&now_c, &now_tm);
-			char	tm_str[64];
-			std::strftime(tm_str, 128, "%Y-%m-%d %H:%M:%S.%%03d", &now_tm);
-			char	tm_full_str[64];
-			std::snprintf(tm_full_str, 64, tm_str, now_ms);
-			(*ostr_) << tm_full_str << " " << i->log(nr_) << std::endl;
 		}
+		// wakes up early when many lines are pending
+		write_batch(recs, lines, BATCH_LINES, std::chrono::milliseconds(BATCH_MSEC));
 	}
+	// what came in while waiting
+	if(*ostr_)
+		write_batch(recs, lines, 0, std::chrono::milliseconds(0));
 }
 
-nettop::async_log::async_log(volatile bool& e, name_res& nr, const std::string& fname, nettop::async_log_list& list) : exit_(e), nr_(nr), ostr_(new std::ofstream(fname.c_str(), std::ios_base::app)), list_(list) {
+nettop::async_log::async_log(volatile bool& e, name_res& nr, const std::string& fname, nettop::async_log_list& list, const bool binary) : exit_(e), nr_(nr), buf_(OUT_BUF_SZ), ostr_(new std::ofstream()), list_(list), binary_(binary) {
 	if(!fname.empty()) {
-		if(!*ostr_)
+		std::ofstream&	ofs = *(std::ofstream*)ostr_.get();
+		// block buffered, flushed once per batch
+		ofs.rdbuf()->pubsetbuf(&buf_[0], buf_.size());
+		struct stat	st;
+		const bool	empty = stat(fname.c_str(), &st) || !st.st_size;
+		if(binary_ && !empty) {
+			std::ifstream	istr(fname.c_str(), std::ios_base::binary);
+			char		magic[sizeof(MAGIC)] = { 0 };
+			if(!istr.read(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)))
+				throw runtime_error("File \"") << fname << "\" is not a binary async_log";
+		}
+		ofs.open(fname.c_str(), std::ios_base::app|(binary_ ? std::ios_base::binary : std::ios_base::out));
+		if(!ofs)
 			throw runtime_error("Can't open file \"") << fname << "\" to write async_log";
-		(*ostr_) << "Log opened/appended" << std::endl;
+		if(binary_) {
+			if(empty)
+				ofs.write(MAGIC, sizeof(MAGIC));
+			// room for two full flushes, as the binder may flush again
+			// before the writer drained the previous one
+			list_.set_binary((OUT_BUF_SZ/sizeof(log_rec) > 2*log_flows::MAX_FLOWS) ? OUT_BUF_SZ/sizeof(log_rec) : 2*log_flows::MAX_FLOWS);
+		} else {
+			ofs << "Log opened/appended" << std::endl;
+			list_.set_text();
+		}
+		thrd_ = std::shared_ptr<std::thread>(new std::thread(&async_log::thread_proc, this));
 	}
-	thrd_ = std::shared_ptr<std::thread>(new std::thread(&async_log::thread_proc, this));
 }
 
 nettop::async_log::~async_log() {
@@ -60,3 +318,41 @@ nettop::async_log::~async_log() {
 		thrd_->join();
 }
 
+void nettop::async_log::decode(const std::string& fname, const bool no_resolve, const std::string& store_fname, std::ostream& out) {
+	std::ifstream	istr(fname.c_str(), std::ios_base::binary);
+	char		magic[sizeof(MAGIC)] = { 0 };
+	if(!istr.read(magic, sizeof(magic)) || std::memcmp(magic, MAGIC, sizeof(MAGIC)))
+		throw runtime_error("File \"") << fname << "\" is not a binary async_log";
+	const name_store				store(store_fname);
+	std::unordered_map<addr_t, std::string>		names;
+	auto	get_name = [&](const addr_t& a) -> const std::string& {
+		auto	it = names.find(a);
+		if(names.end() != it)
+			return it->second;
+		// any stored name, however old, is better than none
+		name_store::record	r;
+		std::string		nm;
+		if(store.find(a, 0, r) && !r.name.empty())
+			nm = r.name;
+		else
+			nm = a.to_str(!no_resolve);
+		return names.insert(std::make_pair(a, nm)).first->second;
+	};
+	log_rec		r;
+	std::string	text;
+	while(istr.read((char*)&r, sizeof(r))) {
+		const std::chrono::system_clock::time_point	tp = ts_to_tp(r.ts_us);
+		if(log_rec::type::TEXT == r.t) {
+			text.resize((r.len + sizeof(log_rec) - 1)/sizeof(log_rec)*sizeof(log_rec));
+			if(!istr.read(&text[0], text.size()))
+				break;
+			text.resize(r.len);
+			out << time_str(tp) << " " << text << '\n';
+			continue;
+		}
+		const addr_t	src = addr_t::from_bytes(AF_INET6, r.src),
+				dst = addr_t::from_bytes(AF_INET6, r.dst);
+		out << time_str(tp) << " " << flow_str((log_rec::type)r.t, r.proto, get_name(src), r.p_src, get_name(dst), r.p_dst, r.pkts, r.bytes, r.dur_us/1000000.0) << '\n';
+	}
+	out << std::flush;
+}
@@ -20,13 +20,19 @@
 #ifndef _ASYNC_LOG_H_
 #define _ASYNC_LOG_H_
 
-#include "mt_list.h"
+#include "bounded_queue.h"
 #include <memory>
 #include <chrono>
 #include <string>
 #include <fstream>
 #include <thread>
+#include <vector>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <stdint.h>
 #include "name_res.h"
+#include "packet_stats.h"
 
 namespace nettop {
 	class async_line {
@@ -38,6 +44,9 @@ public:
 		async_line() : tp_(std::chrono::system_clock::now()) {
 		}
 
+		async_line(const std::chrono::system_clock::time_point& tp) : tp_(tp) {
+		}
+
 		const std::chrono::system_clock::time_point& get_tp(void) {
 			return tp_;
 		}
@@ -49,7 +58,135 @@ public:
 	};
 
 	typedef std::shared_ptr<async_line>	sp_async_line;
-	typedef mt_list<sp_async_line>		async_log_list;
+
+	// record of the binary log: either the packets of a flow
+	// or a TEXT one, followed by the records holding its len
+	// bytes; addresses are stored as ipv6, ipv4 as v4-mapped
+	struct log_rec {
+		enum type {
+			UNDET = 0,
+			UNMAP_R,
+			UNMAP_S,
+			TEXT
+		};
+
+		int64_t		ts_us;		// first packet
+		uint32_t	dur_us,		// up to the last one
+				pkts;
+		uint64_t	bytes;
+		uint16_t	p_src,
+				p_dst,
+				len;
+		uint8_t		t,
+				proto;		// packet_stats::type
+		uint8_t		src[16],
+				dst[16];
+	};
+
+	struct log_flow_key {
+		addr_t		src,
+				dst;
+		uint16_t	p_src,
+				p_dst;
+		uint8_t		t,
+				proto;
+
+		bool operator==(const log_flow_key& rhs) const {
+			return src == rhs.src && dst == rhs.dst && p_src == rhs.p_src && p_dst == rhs.p_dst && t == rhs.t && proto == rhs.proto;
+		}
+	};
+
+	struct log_flow_hash {
+		size_t operator()(const log_flow_key& k) const {
+			return k.src.hash() ^ (k.dst.hash()*31) ^ (((uint64_t)k.p_src << 24) | ((uint64_t)k.p_dst << 8) | (k.t << 4) | k.proto);
+		}
+	};
+
+	struct log_flow {
+		size_t	pkts,
+			bytes;
+		double	first_ts,
+			last_ts;
+	};
+
+	class async_log_list;
+
+	// Packets which couldn't be attributed, coalesced by event
+	// type and 5-tuple: the log grows with the distinct flows
+	// of an interval instead of with the packets
+	class log_flows {
+		typedef std::unordered_map<log_flow_key, log_flow, log_flow_hash>	flow_map;
+
+		flow_map	flows_;
+	public:
+		// flows kept before being flushed anyway, the binary
+		// ring of async_log_list is sized after this
+		static const size_t	MAX_FLOWS = 65536;
+
+		void add(const packet_stats& ps, const log_rec::type t);
+
+		void merge(const log_flows& rhs);
+
+		size_t size(void) const {
+			return flows_.size();
+		}
+
+		// one event per flow, then starts over
+		void flush(async_log_list& log_list);
+	};
+
+	// Events for the async_log thread: text lines or, in binary
+	// mode, records in a preallocated ring which drops what doesn't
+	// fit instead of growing. Nothing is kept until async_log
+	// has chosen the mode.
+	class async_log_list {
+		async_log_list(const async_log_list&) = delete;
+		async_log_list& operator=(const async_log_list&) = delete;
+
+		enum mode {
+			NONE = 0,
+			TEXT,
+			BINARY
+		};
+
+		mode				mode_;
+		bounded_queue<sp_async_line>	lines_;
+		size_t				lines_dropped_;
+		std::mutex			mtx_;
+		std::vector<log_rec>		ring_;
+		size_t				head_,		// records ever written
+						tail_,		// records ever read
+						dropped_;
+
+		// a free record or drop
+		log_rec* reserve(void);
+public:
+		async_log_list();
+
+		// false until async_log has a file to write
+		bool enabled(void) const {
+			return NONE != mode_;
+		}
+
+		void set_text(void);
+
+		void set_binary(const size_t n_recs);
+
+		void push(const sp_async_line& in);
+
+		// packets which couldn't be attributed to a process
+		void push_flow(const log_flow_key& k, const log_flow& f);
+
+		// appends the pending lines to out, waiting up to tmout
+		// for at least min_lines; returns how many lines got
+		// dropped since the last call
+		size_t pop_lines(std::vector<sp_async_line>& out, const size_t min_lines, const std::chrono::milliseconds& tmout);
+
+		// moves the pending records to out and returns how
+		// many got dropped since the last call; lines are
+		// still taken with pop_lines
+		size_t drain(std::vector<log_rec>& out);
+	};
 
 	class async_log {
 		async_log(const async_log&) = delete;
@@ -57,17 +194,30 @@ public:
 
 		volatile bool&			exit_;
 		name_res&			nr_;
+		std::vector<char>		buf_;
 		std::shared_ptr<std::ostream>	ostr_;
 		async_log_list&			list_;
+		const bool			binary_;
 		std::shared_ptr<std::thread>	thrd_;
 		
+		void write_text(std::vector<sp_async_line>& lines, const size_t min_lines, const std::chrono::milliseconds& tmout);
+
+		void write_text_rec(const std::chrono::system_clock::time_point& tp, const std::string& s);
+
+		void write_binary(std::vector<log_rec>& recs, std::vector<sp_async_line>& lines, const size_t min_lines, const std::chrono::milliseconds& tmout);
+
+		void write_batch(std::vector<log_rec>& recs, std::vector<sp_async_line>& lines, const size_t min_lines, const std::chrono::milliseconds& tmout);
+
 		void thread_proc(void);
 public:
-		async_log(volatile bool& e, name_res& nr, const std::string& fname, async_log_list& list);
+		async_log(volatile bool& e, name_res& nr, const std::string& fname, async_log_list& list, const bool binary = false);
 		
 		~async_log();
+
+		// prints a binary log as the text one, resolving the
+		// names unless no_resolve, first with store_fname
+		static void decode(const std::string& fname, const bool no_resolve, const std::string& store_fname, std::ostream& out);
 	};
 }
 
 #endif //_ASYNC_LOG_H_
-
@@ -0,0 +1,276 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "batch_out.h"
+#include "utils.h"
+#include "settings.h"
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace {
+	const char	CSV_HDR[] = "ts,type,pid,cmd,addr,name,recv,sent,recv_rate,sent_rate\n";
+	// initial size of the output buffer, it grows as needed
+	const size_t	BUF_SZ = 64*1024;
+}
+
+void nettop::batch_out::put_uint(uint64_t v) {
+	char	buf[24],
+		*p = buf + sizeof(buf);
+	do {
+		*--p = '0' + v%10;
+		v /= 10;
+	} while(v);
+	put(p, buf + sizeof(buf) - p);
+}
+
+void nettop::batch_out::put_rate(const double v) {
+	const uint64_t	cents = (v > 0.0) ? (uint64_t)(v*100.0 + 0.5) : 0;
+	const char	frac[3] = { (char)('0' + (cents/10)%10), (char)('0' + cents%10), '\0' };
+	put_uint(cents/100);
+	put(".", 1);
+	put(frac, 2);
+}
+
+void nettop::batch_out::append_str(std::string& out, const char* s) const {
+	static const char	HEX[] = "0123456789abcdef";
+	if(JSON == fmt_) {
+		out.append("\"", 1);
+		// runs of plain chars are appended at once
+		const char	*p = s;
+		for(; *p; ++p) {
+			const unsigned char	c = *p;
+			if(c >= 0x20 && c != '"' && c != '\\')
+				continue;
+			out.append(s, p - s);
+			s = p + 1;
+			if(c == '"' || c == '\\') {
+				const char	esc[2] = { '\\', (char)c };
+				out.append(esc, 2);
+			} else {
+				const char	esc[6] = { '\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0x0F] };
+				out.append(esc, 6);
+			}
+		}
+		out.append(s, p - s);
+		out.append("\"", 1);
+		return;
+	}
+	// CSV, only quoted when needed
+	if(!std::strpbrk(s, ",\"\r\n")) {
+		out.append(s);
+		return;
+	}
+	out.append("\"", 1);
+	for(const char *p = s; *p; ++p) {
+		if(*p == '"')
+			out.append("\"\"", 2);
+		else
+			out.append(p, 1);
+	}
+	out.append("\"", 1);
+}
+
+void nettop::batch_out::begin_rec(const char* type) {
+	if(JSON == fmt_) {
+		put("{\"ts\":");
+		put(ts_);
+		put(",\"type\":\"");
+		put(type);
+		put("\"", 1);
+	} else {
+		put(ts_);
+		put(",", 1);
+		put(type);
+	}
+}
+
+void nettop::batch_out::put_field(const char* name, const char* s) {
+	if(JSON == fmt_) {
+		put(",\"", 2);
+		put(name);
+		put("\":", 2);
+	} else {
+		put(",", 1);
+	}
+	append_str(buf_, s);
+}
+
+void nettop::batch_out::put_field(const char* name, const std::string& esc) {
+	if(JSON == fmt_) {
+		put(",\"", 2);
+		put(name);
+		put("\":", 2);
+	} else {
+		put(",", 1);
+	}
+	put(esc.data(), esc.size());
+}
+
+void nettop::batch_out::put_field(const char* name, const uint64_t v) {
+	if(JSON == fmt_) {
+		put(",\"", 2);
+		put(name);
+		put("\":", 2);
+	} else {
+		put(",", 1);
+	}
+	put_uint(v);
+}
+
+void nettop::batch_out::put_field(const char* name, const int64_t v) {
+	if(v >= 0) {
+		put_field(name, (uint64_t)v);
+		return;
+	}
+	if(JSON == fmt_) {
+		put(",\"", 2);
+		put(name);
+		put("\":", 2);
+	} else {
+		put(",", 1);
+	}
+	put("-", 1);
+	put_uint(-(uint64_t)v);
+}
+
+void nettop::batch_out::put_rates(const uint64_t recv, const uint64_t sent, const double recv_rate, const double sent_rate) {
+	put_field("recv", recv);
+	put_field("sent", sent);
+	if(JSON == fmt_)
+		put(",\"recv_rate\":");
+	else
+		put(",", 1);
+	put_rate(recv_rate);
+	if(JSON == fmt_)
+		put(",\"sent_rate\":");
+	else
+		put(",", 1);
+	put_rate(sent_rate);
+}
+
+void nettop::batch_out::end_rec(void) {
+	if(JSON == fmt_)
+		put("}\n", 2);
+	else
+		put("\n", 1);
+}
+
+void nettop::batch_out::flush(void) {
+	const char	*p = buf_.data();
+	size_t		left = buf_.size();
+	while(left) {
+		const ssize_t	rv = ::write(fd_, p, left);
+		if(-1 == rv) {
+			if(EINTR == errno)
+				continue;
+			throw runtime_error("Can't write batch output: ") << std::strerror(errno);
+		}
+		p += rv;
+		left -= rv;
+	}
+	// capacity is kept for the next interval
+	buf_.clear();
+}
+
+nettop::batch_out::batch_out(const format fmt, const std::string& fname, name_res& nr, const prefix_agg* agg) : fmt_(fmt), fd_(STDOUT_FILENO), nr_(nr), agg_(agg) {
+	if(!fname.empty()) {
+		fd_ = open(fname.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+		if(-1 == fd_)
+			throw runtime_error("Can't open file \"") << fname << "\" for batch output: " << std::strerror(errno);
+	}
+	buf_.reserve(BUF_SZ);
+	ts_[0] = '\0';
+	struct stat	st;
+	if(CSV == fmt_ && (fstat(fd_, &st) || !S_ISREG(st.st_mode) || !st.st_size)) {
+		put(CSV_HDR, sizeof(CSV_HDR) - 1);
+		flush();
+	}
+}
+
+nettop::batch_out::~batch_out() {
+	if(STDOUT_FILENO != fd_)
+		close(fd_);
+}
+
+void nettop::batch_out::write(const std::chrono::system_clock::time_point& ts, const ps_vec& p_vec, const proc_mgr::stats& st) {
+	const int64_t	ts_ms = std::chrono::duration_cast<std::chrono::milliseconds>(ts.time_since_epoch()).count();
+	std::snprintf(ts_, sizeof(ts_), "%ld.%03ld", (long)(ts_ms/1000), (long)(ts_ms%1000));
+	uint64_t	tot_recv = 0,
+			tot_sent = 0;
+	double		tot_recv_rate = 0.0,
+			tot_sent_rate = 0.0;
+	char		addr[INET6_ADDRSTRLEN];
+	for(const auto& p : p_vec) {
+		tot_recv += p.total_rs.first;
+		tot_sent += p.total_rs.second;
+		tot_recv_rate += p.rate_rs.first;
+		tot_sent_rate += p.rate_rs.second;
+		if(settings::FILTER_ZERO && !p.total_rs.first && !p.total_rs.second)
+			continue;
+		// escaped once, it's repeated on each host
+		cmd_.clear();
+		append_str(cmd_, p.cmd.c_str());
+		begin_rec("proc");
+		put_field("pid", (int64_t)p.pid);
+		put_field("cmd", cmd_);
+		if(CSV == fmt_)
+			put(",,", 2);
+		put_rates(p.total_rs.first, p.total_rs.second, p.rate_rs.first, p.rate_rs.second);
+		end_rec();
+		// hosts are in addr_rs_map order, as their rates
+		size_t	h_idx = 0;
+		for(const auto& h : p.addr_rs_map) {
+			const std::pair<double, double>	h_r = (h_idx < p.addr_rates.size()) ? p.addr_rates[h_idx] : std::make_pair(0.0, 0.0);
+			++h_idx;
+			begin_rec("host");
+			put_field("pid", (int64_t)p.pid);
+			put_field("cmd", cmd_);
+			// aggregated hosts get their network and its label, without resolving
+			if(agg_ && agg_->net_str(h.first, net_)) {
+				agg_->label(h.first, lbl_);
+				put_field("addr", net_.c_str());
+				put_field("name", lbl_.c_str());
+			} else {
+				if(!h.first.to_num_buf(addr))
+					addr[0] = '\0';
+				put_field("addr", addr);
+				const name_res::name_ref	nm = nr_.lookup(h.first);
+				put_field("name", nm.c_str());
+			}
+			put_rates(h.second.recv, h.second.sent, h_r.first, h_r.second);
+			end_rec();
+		}
+	}
+	begin_rec("total");
+	if(CSV == fmt_)
+		put(",,,,", 4);
+	put_rates(tot_recv, tot_sent, tot_recv_rate, tot_sent_rate);
+	if(JSON == fmt_) {
+		put_field("pkts", (uint64_t)st.total_pkts);
+		put_field("unbound_pkts", (uint64_t)(st.total_pkts - st.proc_pkts));
+		put_field("dropped_pkts", (uint64_t)st.drop_pkts);
+	}
+	end_rec();
+	flush();
+}
+
@@ -0,0 +1,104 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _BATCH_OUT_H_
+#define _BATCH_OUT_H_
+
+#include <string>
+#include <chrono>
+#include <stdint.h>
+#include "proc.h"
+#include "name_res.h"
+#include "prefix_agg.h"
+
+namespace nettop {
+	// Headless output: at each refresh writes one record per
+	// process, one per remote host of each process and one with
+	// the totals, either as JSON Lines or CSV. Records of an
+	// interval are formatted into a buffer which is reused and
+	// then written with a single call, so readers on a pipe get
+	// whole intervals.
+	class batch_out {
+		batch_out(const batch_out&) = delete;
+		batch_out& operator=(const batch_out&) = delete;
+	public:
+		enum format {
+			NONE = 0,
+			JSON,
+			CSV
+		};
+	private:
+		const format		fmt_;
+		int			fd_;
+		name_res&		nr_;
+		const prefix_agg	*agg_;
+		std::string		buf_,
+					cmd_,	// cmdline of the current process, escaped
+					lbl_,	// aggregated host label
+					net_;	// and its network
+		// timestamp of the current interval, already formatted
+		char			ts_[32];
+
+		void put(const char* s, const size_t len) {
+			buf_.append(s, len);
+		}
+
+		void put(const char* s) {
+			buf_.append(s);
+		}
+
+		void put_uint(uint64_t v);
+
+		// fixed 2 decimals, negatives are 0
+		void put_rate(const double v);
+
+		// escaped for JSON or quoted for CSV
+		void append_str(std::string& out, const char* s) const;
+
+		void begin_rec(const char* type);
+
+		void put_field(const char* name, const char* s);
+
+		// esc is already escaped
+		void put_field(const char* name, const std::string& esc);
+
+		void put_field(const char* name, const uint64_t v);
+
+		// the kernel has pid -1
+		void put_field(const char* name, const int64_t v);
+
+		void put_rates(const uint64_t recv, const uint64_t sent, const double recv_rate, const double sent_rate);
+
+		void end_rec(void);
+
+		void flush(void);
+	public:
+		// writes to stdout when fname is empty, otherwise appends
+		// to fname; the CSV header is only written to empty outputs
+		batch_out(const format fmt, const std::string& fname, name_res& nr, const prefix_agg* agg);
+
+		~batch_out();
+
+		// rates are the ones of the chosen sort window
+		void write(const std::chrono::system_clock::time_point& ts, const ps_vec& p_vec, const proc_mgr::stats& st);
+	};
+}
+
+#endif //_BATCH_OUT_H_
+
@@ -0,0 +1,102 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "binder.h"
+#include "settings.h"
+#include <vector>
+#include <chrono>
+
+namespace {
+	// a batch is bound as soon as it has this many packets
+	const size_t	BATCH_PKTS = 4096;
+	// or after waiting for this long
+	const size_t	BATCH_MSEC = 50;
+}
+
+void nettop::binder::bind_batch(const std::vector<packet_stats>& batch) {
+	if(batch.empty())
+		return;
+	p_mgr_->bind_packets(batch, lam_, st_, log_list_.enabled() ? &flows_ : 0, hs_.get(), tp_.get(), agg_.get(), pe_.get());
+	// bound even when each packet is a new flow
+	if(flows_.size() >= log_flows::MAX_FLOWS)
+		flows_.flush(log_list_);
+}
+
+void nettop::binder::thread_proc(void) {
+	std::vector<packet_stats>	batch;
+	while(!exit_) {
+		// wait outside of the lock, snapshot
+		// drains the queue on its own
+		p_list_.pop_many(batch, BATCH_PKTS, std::chrono::milliseconds(BATCH_MSEC));
+		std::lock_guard<std::mutex>	lg(mtx_);
+		bind_batch(batch);
+		batch.clear();
+	}
+}
+
+nettop::binder::binder(volatile bool& e, packet_list& p_list, const local_addr_mgr& lam, async_log_list& log_list) : exit_(e), p_list_(p_list), lam_(lam), log_list_(log_list), p_mgr_(new proc_mgr()), last_dropped_(0) {
+	if(settings::GLOBAL_HOSTS_ROWS)
+		hs_ = std::shared_ptr<hosts_sketch>(new hosts_sketch(settings::CMS_WIDTH, settings::CMS_DEPTH, settings::GLOBAL_HOSTS_ROWS, settings::CMS_DECAY));
+	if(settings::AGG_V4_LEN || settings::AGG_V6_LEN || !settings::AGG_CIDR_FILE.empty())
+		agg_ = std::shared_ptr<prefix_agg>(new prefix_agg(settings::AGG_V4_LEN, settings::AGG_V6_LEN, settings::AGG_CIDR_FILE));
+	if(!settings::PCAP_EXPORT_FILE.empty())
+		pe_ = std::shared_ptr<pcap_export>(new pcap_export(exit_, settings::PCAP_EXPORT_FILE, settings::PCAP_MAX_MB*1024*1024, settings::PCAP_PID));
+	if(settings::BIND_THREADS > 1) {
+		tp_ = std::shared_ptr<thread_pool>(new thread_pool(settings::BIND_THREADS));
+		if(hs_)
+			hs_->set_shards(tp_->size());
+	}
+	thrd_ = std::shared_ptr<std::thread>(new std::thread(&binder::thread_proc, this));
+}
+
+void nettop::binder::snapshot(const std::shared_ptr<proc_mgr>& next, ps_vec& out, proc_mgr::stats& st, hosts_sketch::hh_vec& top_hosts) {
+	std::lock_guard<std::mutex>	lg(mtx_);
+	// bind what is left of this interval, looking up the sockets
+	// which have been opened in the meantime too
+	p_mgr_->set_next(next.get());
+	std::vector<packet_stats>	batch;
+	p_list_.pop_many(batch, 0, std::chrono::milliseconds(0));
+	bind_batch(batch);
+	// still in this interval, even when found in the next snapshot
+	p_mgr_->bind_unmapped(st_, log_list_.enabled() ? &flows_ : 0, agg_.get(), pe_.get());
+	p_mgr_->get_stats(out);
+	flows_.flush(log_list_);
+	st = st_;
+	// for the real total counter, we are using an atomic type
+	// _mostly_ accurate
+	st.total_pkts = p_list_.total_pkts.exchange(0);
+	const size_t	dropped = p_list_.get_stats().dropped;
+	// on top of the ones which couldn't be kept for bind_unmapped
+	st.drop_pkts += dropped - last_dropped_;
+	last_dropped_ = dropped;
+	st_ = proc_mgr::stats();
+	// only now, as it drops the generation before this one
+	next->set_prev(p_mgr_);
+	if(hs_) {
+		hs_->get_top(top_hosts);
+		hs_->decay();
+	}
+	p_mgr_ = next;
+}
+
+nettop::binder::~binder() {
+	if(thrd_)
+		thrd_->join();
+}
@@ -0,0 +1,78 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _BINDER_H_
+#define _BINDER_H_
+
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include "cap_mgr.h"
+#include "proc.h"
+#include "hosts_sketch.h"
+#include "prefix_agg.h"
+#include "pcap_export.h"
+
+namespace nettop {
+	// continuously drains the captured packets in small batches
+	// and binds them to the current processes snapshot, so that
+	// a refresh only has to collect the running totals
+	class binder {
+		binder(const binder&) = delete;
+		binder& operator=(const binder&) = delete;
+
+		volatile bool&			exit_;
+		packet_list&			p_list_;
+		const local_addr_mgr&		lam_;
+		async_log_list&			log_list_;
+		std::mutex			mtx_;
+		std::shared_ptr<proc_mgr>	p_mgr_;
+		proc_mgr::stats			st_;
+		// packets the capture queue dropped so far
+		size_t				last_dropped_;
+		log_flows			flows_;
+		std::shared_ptr<hosts_sketch>	hs_;
+		std::shared_ptr<thread_pool>	tp_;
+		std::shared_ptr<prefix_agg>	agg_;
+		std::shared_ptr<pcap_export>	pe_;
+		std::shared_ptr<std::thread>	thrd_;
+
+		void bind_batch(const std::vector<packet_stats>& batch);
+
+		void thread_proc(void);
+public:
+		binder(volatile bool& e, packet_list& p_list, const local_addr_mgr& lam, async_log_list& log_list);
+
+		// returns the totals since last call, flushes the flows
+		// which couldn't be attributed, and starts binding
+		// the next packets against the new processes snapshot
+		void snapshot(const std::shared_ptr<proc_mgr>& next, ps_vec& out, proc_mgr::stats& st, hosts_sketch::hh_vec& top_hosts);
+
+		// null when remote hosts are not aggregated
+		const prefix_agg* get_agg(void) const {
+			return agg_.get();
+		}
+
+		~binder();
+	};
+}
+
+#endif //_BINDER_H_
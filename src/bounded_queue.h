@@ -0,0 +1,172 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _BOUNDED_QUEUE_H_
+#define _BOUNDED_QUEUE_H_
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory>
+#include <type_traits>
+#include <new>
+#include <utility>
+
+// Multi producer / multi consumer FIFO with a hard cap on the
+// number of queued elements; storage grows on demand up to cap,
+// then the policy decides which element is dropped
+template<typename T>
+class bounded_queue {
+	
+	bounded_queue(const bounded_queue&) = delete;
+	bounded_queue& operator=(const bounded_queue&) = delete;
+public:
+	enum policy {
+		DROP_NEWEST = 0,
+		DROP_OLDEST
+	};
+
+	struct stats {
+		size_t	pushed,
+			popped,
+			dropped;
+
+		stats() : pushed(0), popped(0), dropped(0) {
+		}
+	};
+private:
+	typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type	slot;
+
+	std::mutex			mtx_;
+	std::condition_variable		cv_;
+	const size_t			cap_;
+	const policy			pol_;
+	std::unique_ptr<slot[]>		slots_;
+	size_t				alloc_,
+					head_,
+					size_;
+	// consumers currently waiting and the
+	// smallest number of elements they want
+	size_t				n_waiting_,
+					min_wake_;
+	stats				st_;
+
+	T* at(const size_t i) {
+		return reinterpret_cast<T*>(&slots_[(head_ + i) % alloc_]);
+	}
+
+	// moves the elements into a larger ring,
+	// oldest first
+	void grow(void) {
+		const size_t		n_alloc = (alloc_*2 < cap_) ? alloc_*2 : cap_;
+		std::unique_ptr<slot[]>	n_slots(new slot[n_alloc]);
+		for(size_t i = 0; i < size_; ++i) {
+			T	*p = at(i);
+			new (&n_slots[i]) T(std::move(*p));
+			p->~T();
+		}
+		slots_.swap(n_slots);
+		alloc_ = n_alloc;
+		head_ = 0;
+	}
+
+	// needs mtx_ to be held
+	void push_one(const T& in) {
+		if(size_ == cap_) {
+			++st_.dropped;
+			if(DROP_NEWEST == pol_)
+				return;
+			at(0)->~T();
+			head_ = (head_ + 1) % alloc_;
+			--size_;
+		} else if(size_ == alloc_) {
+			grow();
+		}
+		new (at(size_)) T(in);
+		++size_;
+		++st_.pushed;
+	}
+
+	void notify(void) {
+		if(n_waiting_ && size_ >= min_wake_)
+			cv_.notify_all();
+	}
+public:
+	bounded_queue(const size_t cap, const policy pol = DROP_NEWEST) : cap_(cap ? cap : 1), pol_(pol), alloc_((cap_ < 64) ? cap_ : 64), head_(0), size_(0), n_waiting_(0), min_wake_(1) {
+		slots_.reset(new slot[alloc_]);
+	}
+
+	~bounded_queue() {
+		for(size_t i = 0; i < size_; ++i)
+			at(i)->~T();
+	}
+
+	void push(const T& in) {
+		std::lock_guard<std::mutex>	lg(mtx_);
+		push_one(in);
+		notify();
+	}
+
+	template<typename It>
+	void push_many(It it, const It it_end) {
+		std::lock_guard<std::mutex>	lg(mtx_);
+		for(; it != it_end; ++it)
+			push_one(*it);
+		notify();
+	}
+
+	// appends to out up to max_items elements, waiting at most tmout
+	// for min_items of them to be available; returns the number of
+	// elements appended, which can be less than min_items on timeout
+	template<typename C>
+	size_t pop_many(C& out, const size_t min_items, const std::chrono::milliseconds& tmout, const size_t max_items = (size_t)-1) {
+		std::unique_lock<std::mutex>	ul(mtx_);
+		if(size_ < min_items && tmout.count() > 0) {
+			if(!n_waiting_ || min_items < min_wake_)
+				min_wake_ = min_items;
+			++n_waiting_;
+			cv_.wait_for(ul, tmout, [&](){ return size_ >= min_items; });
+			if(!--n_waiting_)
+				min_wake_ = 1;
+		}
+		const size_t	n = (size_ < max_items) ? size_ : max_items;
+		for(size_t i = 0; i < n; ++i) {
+			T	*p = at(i);
+			out.push_back(std::move(*p));
+			p->~T();
+		}
+		head_ = (head_ + n) % alloc_;
+		size_ -= n;
+		st_.popped += n;
+		return n;
+	}
+
+	size_t size(void) {
+		std::lock_guard<std::mutex>	lg(mtx_);
+		return size_;
+	}
+
+	stats get_stats(void) {
+		std::lock_guard<std::mutex>	lg(mtx_);
+		return st_;
+	}
+};
+
+#endif //_BOUNDED_QUEUE_H_
+
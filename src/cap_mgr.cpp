@@ -27,11 +27,27 @@
 #include <chrono>
 #include <thread>
 #include <atomic>
+#include <vector>
 #include "addr_t.h"
+#include "settings.h"
 
 namespace {
 
-	typedef std::list<nettop::packet_stats>	st_pkt_list;
+	typedef std::vector<nettop::packet_stats>	st_pkt_list;
+
+	// what gets collected by a single dispatch
+	struct cap_ctx {
+		st_pkt_list		pkts;
+		std::vector<std::string>	dns;
+		bool			want_dns;
+
+		cap_ctx(const bool want_dns_) : want_dns(want_dns_) {
+		}
+	};
+
+	const uint16_t	DNS_PORT = 53;
+	// enough for the link, ip and the ports of any packet
+	const u_int	HDR_SNAP = 128;
 
 	// linux cooked header
 	// glanced from libpcap/ssl.h
@@ -46,30 +62,35 @@ namespace {
         	u_int16_t	sll_protocol;         /* protocol */
 	};
 
-	inline void process_tcp(const u_char *data, st_pkt_list& p_list, const double ts, const size_t len, const addr_t& src, const addr_t& dst) {
+	inline void process_tcp(const u_char *data, const u_char *end, cap_ctx& ctx, const double ts, const size_t len, const addr_t& src, const addr_t& dst) {
 		const struct tcphdr	*tcp = (struct tcphdr*)data;
 		const uint16_t		p_src = ntohs(tcp->source),
 					p_dst = ntohs(tcp->dest);
-		p_list.push_back(nettop::packet_stats(src, dst, p_src, p_dst, len, nettop::packet_stats::type::PACKET_TCP, ts));
+		ctx.pkts.push_back(nettop::packet_stats(src, dst, p_src, p_dst, len, nettop::packet_stats::type::PACKET_TCP, ts));
 	}
 
-	inline void process_udp(const u_char *data, st_pkt_list& p_list, const double ts, const size_t len, const addr_t& src, const addr_t& dst) {
+	inline void process_udp(const u_char *data, const u_char *end, cap_ctx& ctx, const double ts, const size_t len, const addr_t& src, const addr_t& dst) {
 		const struct udphdr	*udp = (struct udphdr*)data;
 		const uint16_t		p_src = ntohs(udp->source),
 					p_dst = ntohs(udp->dest);
-		p_list.push_back(nettop::packet_stats(src, dst, p_src, p_dst, len, nettop::packet_stats::type::PACKET_UDP, ts));
+		ctx.pkts.push_back(nettop::packet_stats(src, dst, p_src, p_dst, len, nettop::packet_stats::type::PACKET_UDP, ts));
+		// only copy here, parsing happens in passive_dns
+		if(ctx.want_dns && DNS_PORT == p_src && data + sizeof(struct udphdr) < end)
+			ctx.dns.push_back(std::string((const char*)data + sizeof(struct udphdr), end - data - sizeof(struct udphdr)));
 	}
 
-	inline void process_ip(const u_char *data, st_pkt_list& p_list, const double ts, const size_t len) {
+	inline void process_ip(const u_char *data, const u_char *end, cap_ctx& ctx, const double ts, const size_t len) {
 		const struct ip *ip = (struct ip*)data;
 		const addr_t	src(ip->ip_src),
 				dst(ip->ip_dst);
+		// skip the options too
+		const size_t	hdr_len = 4*ip->ip_hl;
 		switch(ip->ip_p) {
 			case IPPROTO_TCP:
-				process_tcp(data + sizeof(struct ip), p_list, ts, len, src, dst);
+				process_tcp(data + hdr_len, end, ctx, ts, len, src, dst);
 				break;
 			case IPPROTO_UDP:
-				process_udp(data + sizeof(struct ip), p_list, ts, len, src, dst);
+				process_udp(data + hdr_len, end, ctx, ts, len, src, dst);
 				break;
 			default:
 				//std::cerr << "Unknown ip protocol " << (int)ip->ip_p << ", skipping packet" << std::endl;
@@ -77,16 +98,16 @@ namespace {
 		}
 	}
 
-	inline void process_ip6(const u_char *data, st_pkt_list& p_list, const double ts, const size_t len) {
+	inline void process_ip6(const u_char *data, const u_char *end, cap_ctx& ctx, const double ts, const size_t len) {
 		const struct ip6_hdr	*ip6 = (struct ip6_hdr*)data;
 		const addr_t		src(ip6->ip6_src),
 					dst(ip6->ip6_dst);
 		switch(ip6->ip6_nxt) {
 			case IPPROTO_TCP:
-				process_tcp(data + sizeof(struct ip6_hdr), p_list, ts, len, src, dst);
+				process_tcp(data + sizeof(struct ip6_hdr), end, ctx, ts, len, src, dst);
 				break;
 			case IPPROTO_UDP:
-				process_udp(data + sizeof(struct ip6_hdr), p_list, ts, len, src, dst);
+				process_udp(data + sizeof(struct ip6_hdr), end, ctx, ts, len, src, dst);
 				break;
 			default:
 				//std::cerr << "Unknown ip protocol " << (int)ip6->ip6_nxt << ", skipping packet" << std::endl;
@@ -96,14 +117,15 @@ namespace {
 
 	void p_handler(u_char *user, const struct pcap_pkthdr *header, const u_char *data) {
 		const struct sll_header *sll = (struct sll_header*)data;
-		st_pkt_list& 		p_list = *(st_pkt_list*)user;
+		cap_ctx& 		ctx = *(cap_ctx*)user;
 		const double		ts = nettop::tv_to_sec(header->ts);
+		const u_char		*end = data + header->caplen;
 		switch(sll->sll_protocol) {
 			case SLL_PROTOCOL_IP:
-				process_ip(data + sizeof(struct sll_header), p_list, ts, header->len);
+				process_ip(data + sizeof(struct sll_header), end, ctx, ts, header->len);
 				break;
 			case SLL_PROTOCOL_IP6:
-				process_ip6(data + sizeof(struct sll_header), p_list, ts, header->len);
+				process_ip6(data + sizeof(struct sll_header), end, ctx, ts, header->len);
 				break;
 			default:
 				//std::cerr << "Unknown SLL protocol " << (int)sll->sll_protocol << ", skipping packet" << std::endl;
@@ -124,25 +146,57 @@ nettop::cap_mgr::cap_mgr() : p_(0) {
 		pcap_close(p_);
 		throw runtime_error("Link type: ") << link_type << ", only DLT_LINUX_SLL (" << DLT_LINUX_SLL << ") supported!";
 	}
+	set_snap_filter(settings::PASSIVE_DNS);
+}
+
+void nettop::cap_mgr::set_snap_filter(const bool dns) {
+	// a BPF program returns how many bytes of the packet to keep:
+	// only the headers, but for UDP packets from port 53 when dns
+	// is set; packets lengths are still the original ones
+	const u_int		dns_snap = dns ? BUFSIZ : HDR_SNAP;
+	const u_int		sll_sz = sizeof(struct sll_header);
+	struct bpf_insn		insns[] = {
+		/* 0 */ BPF_STMT(BPF_LD|BPF_H|BPF_ABS, 14),			// sll protocol
+		/* 1 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x0800, 0, 5),
+		/* 2 */ BPF_STMT(BPF_LD|BPF_B|BPF_ABS, sll_sz + 9),		// ipv4 protocol
+		/* 3 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_UDP, 0, 9),
+		/* 4 */ BPF_STMT(BPF_LDX|BPF_B|BPF_MSH, sll_sz),		// ipv4 header length
+		/* 5 */ BPF_STMT(BPF_LD|BPF_H|BPF_IND, sll_sz),			// udp source port
+		/* 6 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, DNS_PORT, 5, 6),
+		/* 7 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, 0x86DD, 0, 5),
+		/* 8 */ BPF_STMT(BPF_LD|BPF_B|BPF_ABS, sll_sz + 6),		// ipv6 next header
+		/* 9 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, IPPROTO_UDP, 0, 3),
+		/* 10 */ BPF_STMT(BPF_LD|BPF_H|BPF_ABS, sll_sz + 40),		// udp source port
+		/* 11 */ BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, DNS_PORT, 0, 1),
+		/* 12 */ BPF_STMT(BPF_RET|BPF_K, dns_snap),
+		/* 13 */ BPF_STMT(BPF_RET|BPF_K, HDR_SNAP),
+	};
+	struct bpf_program	prog;
+	prog.bf_len = sizeof(insns)/sizeof(insns[0]);
+	prog.bf_insns = insns;
+	if(-1 == pcap_setfilter(p_, &prog))
+		throw runtime_error("Can't set capture filter: ") << pcap_geterr(p_);
 }
 
 nettop::cap_mgr::~cap_mgr() {
 	pcap_close(p_);
 }
 
-void nettop::cap_mgr::capture_dispatch(packet_list& p_list) {
-	st_pkt_list	lcl_list;
-	const int dres = pcap_dispatch(p_, -1, p_handler, (u_char*)&lcl_list);
+void nettop::cap_mgr::capture_dispatch(packet_list& p_list, dns_list* d_list) {
+	cap_ctx	ctx(d_list != 0);
+	const int dres = pcap_dispatch(p_, -1, p_handler, (u_char*)&ctx);
 	// we never call pcap_breakloop
 	if(-1 == dres)
 		throw runtime_error(pcap_geterr(p_));
-	p_list.push_many(lcl_list);
+	p_list.push_many(ctx.pkts.begin(), ctx.pkts.end());
 	p_list.total_pkts += dres;
+	if(!ctx.dns.empty())
+		d_list->push_many(ctx.dns.begin(), ctx.dns.end());
 }
 
-void nettop::cap_mgr::async_cap(packet_list& p_list, volatile bool& quit) {
+void nettop::cap_mgr::async_cap(packet_list& p_list, volatile bool& quit, dns_list* d_list) {
 	while(!quit) {
-		capture_dispatch(p_list);
+		capture_dispatch(p_list, d_list);
 	}
 }
 
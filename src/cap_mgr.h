@@ -22,14 +22,23 @@
 
 #include <pcap.h>
 #include <atomic>
-#include "mt_list.h"
+#include <string>
+#include "bounded_queue.h"
 #include "packet_stats.h"
 
 namespace nettop {
-	struct packet_list : public mt_list<packet_stats> {
+	// when full the capture drops the new packets
+	struct packet_list : public bounded_queue<packet_stats> {
 		std::atomic<size_t>	total_pkts;
 
-		packet_list() : total_pkts(0) {
+		packet_list(const size_t max_pkts) : bounded_queue<packet_stats>(max_pkts, DROP_NEWEST), total_pkts(0) {
+		}
+	};
+
+	// UDP payloads of the DNS responses, the
+	// most recent ones are kept when full
+	struct dns_list : public bounded_queue<std::string> {
+		dns_list() : bounded_queue<std::string>(4096, DROP_OLDEST) {
 		}
 	};
 
@@ -38,14 +47,18 @@ namespace nettop {
 		cap_mgr& operator=(const cap_mgr&) = delete;
 
 		pcap_t	*p_;
+
+		// keeps the payload of DNS responses only when dns is set
+		void set_snap_filter(const bool dns);
 public:
 		cap_mgr();
 
 		~cap_mgr();
 
-		void capture_dispatch(packet_list& p_list);
+		// DNS responses go to d_list when not null
+		void capture_dispatch(packet_list& p_list, dns_list* d_list);
 
-		void async_cap(packet_list& p_list, volatile bool& quit);
+		void async_cap(packet_list& p_list, volatile bool& quit, dns_list* d_list);
 	};
 }
 
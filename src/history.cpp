@@ -0,0 +1,403 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "history.h"
+#include "settings.h"
+#include "utils.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+namespace {
+	const char	MAGIC[8] = { 'N', 'T', 'H', 'I', 'S', 'T', '0', '1' };
+	const uint32_t	VERSION = 1;
+	// the cmdlines table of a new file has one entry every
+	// STR_ROWS rows, within these bounds
+	const size_t	STR_SZ = 128,
+			MIN_STRS = 4096,
+			MAX_STRS = 1024*1024,
+			STR_ROWS = 16,
+			HDR_SZ = 4096,
+			HOST_SZ = 16,
+			COL_ALIGN = 64;
+	const uint32_t	NO_STR = 0xFFFFFFFF;
+
+	size_t col_align(const size_t sz) {
+		return (sz + COL_ALIGN - 1) & ~(COL_ALIGN - 1);
+	}
+
+	// offsets of the columns in the file
+	struct layout {
+		size_t	ts,
+			pid,
+			cmd,
+			af,
+			host,
+			recv,
+			sent,
+			strs,
+			total;
+
+		layout(const size_t n_rows, const size_t n_strs) {
+			ts = HDR_SZ;
+			pid = ts + col_align(sizeof(int64_t)*n_rows);
+			cmd = pid + col_align(sizeof(int32_t)*n_rows);
+			af = cmd + col_align(sizeof(uint32_t)*n_rows);
+			host = af + col_align(sizeof(uint8_t)*n_rows);
+			recv = host + col_align(HOST_SZ*n_rows);
+			sent = recv + col_align(sizeof(uint64_t)*n_rows);
+			strs = sent + col_align(sizeof(uint64_t)*n_rows);
+			total = strs + STR_SZ*n_strs;
+		}
+	};
+
+	std::string bytes_str(const uint64_t b) {
+		static const char*	UNITS[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+		double			v = b;
+		size_t			u = 0;
+		while(v >= 1024.0 && u < sizeof(UNITS)/sizeof(UNITS[0]) - 1) {
+			v /= 1024.0;
+			++u;
+		}
+		char	buf[32];
+		std::snprintf(buf, 32, "%.2f %s", v, UNITS[u]);
+		return buf;
+	}
+
+	std::string time_str(const std::time_t t) {
+		std::tm	t_tm;
+		localtime_r(&t, &t_tm);
+		char	buf[64];
+		std::strftime(buf, 64, "%Y-%m-%d %H:%M:%S", &t_tm);
+		return buf;
+	}
+
+	std::time_t parse_time(const std::string& s, const std::time_t now) {
+		char		*end = 0;
+		const long long	v = std::strtoll(s.c_str(), &end, 10);
+		if(!s.empty() && !*end)
+			return (v < 0) ? now + v : v;
+		static const char*	FMTS[] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%H:%M:%S", "%H:%M" };
+		for(size_t i = 0; i < sizeof(FMTS)/sizeof(FMTS[0]); ++i) {
+			std::tm		t_tm;
+			localtime_r(&now, &t_tm);
+			t_tm.tm_sec = 0;
+			const char	*p = strptime(s.c_str(), FMTS[i], &t_tm);
+			if(p && !*p) {
+				t_tm.tm_isdst = -1;
+				return std::mktime(&t_tm);
+			}
+		}
+		throw nettop::runtime_error("Invalid history time \"") << s << "\"";
+	}
+
+	// sorts descending on total bytes and keeps the first n
+	template<typename M, typename V>
+	void top_n(const M& m, const size_t n, V& out) {
+		typedef typename V::value_type	val_type;
+		struct sort_fctr {
+			bool operator()(const val_type& lhs, const val_type& rhs) const {
+				return lhs.second.first + lhs.second.second > rhs.second.first + rhs.second.second;
+			}
+		};
+		out.assign(m.begin(), m.end());
+		const size_t	top = std::min(n, out.size());
+		std::partial_sort(out.begin(), out.begin() + top, out.end(), sort_fctr());
+		out.resize(top);
+	}
+}
+
+struct nettop::history::header {
+	char		magic[8];
+	uint32_t	version,
+			str_sz;
+	uint64_t	n_rows,
+			n_strs,
+			head,		// rows ever written
+			str_used,
+			// first row which is still valid, moved before
+			// the rows get overwritten; 0 in files written
+			// by older versions, where head - n_rows applies
+			tail,
+			str_full;	// rows written without a cmdline
+};
+
+struct nettop::history::str_entry {
+	char	s[STR_SZ];
+};
+
+nettop::history::history(const std::string& fname, const size_t n_rows, const bool rdonly) : rdonly_(rdonly), fd_(-1), map_(MAP_FAILED), map_sz_(0), hdr_(0) {
+	fd_ = open(fname.c_str(), rdonly ? O_RDONLY : (O_RDWR|O_CREAT), 0644);
+	if(-1 == fd_)
+		throw runtime_error("Can't open history file \"") << fname << "\": " << std::strerror(errno);
+	struct stat	st;
+	if(fstat(fd_, &st)) {
+		close(fd_);
+		throw runtime_error("Can't stat history file \"") << fname << "\": " << std::strerror(errno);
+	}
+	header	hdr;
+	if(!st.st_size && !rdonly_) {
+		// brand new file
+		if(!n_rows) {
+			close(fd_);
+			throw runtime_error("Invalid number of history rows");
+		}
+		std::memset(&hdr, 0x00, sizeof(hdr));
+		std::memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+		hdr.version = VERSION;
+		hdr.str_sz = STR_SZ;
+		hdr.n_rows = n_rows;
+		hdr.n_strs = std::min(MAX_STRS, std::max(MIN_STRS, n_rows/STR_ROWS));
+		if(ftruncate(fd_, layout(hdr.n_rows, hdr.n_strs).total) || (ssize_t)sizeof(hdr) != pwrite(fd_, &hdr, sizeof(hdr), 0)) {
+			close(fd_);
+			throw runtime_error("Can't initialize history file \"") << fname << "\": " << std::strerror(errno);
+		}
+	} else if((ssize_t)sizeof(hdr) != pread(fd_, &hdr, sizeof(hdr), 0) || std::memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) || hdr.version != VERSION || hdr.str_sz != STR_SZ) {
+		close(fd_);
+		throw runtime_error("File \"") << fname << "\" is not a valid history file";
+	}
+	const layout	l(hdr.n_rows, hdr.n_strs);
+	if((size_t)st.st_size > 0 && (size_t)st.st_size < l.total) {
+		close(fd_);
+		throw runtime_error("History file \"") << fname << "\" is truncated";
+	}
+	map_sz_ = l.total;
+	map_ = mmap(0, map_sz_, rdonly_ ? PROT_READ : (PROT_READ|PROT_WRITE), MAP_SHARED, fd_, 0);
+	if(MAP_FAILED == map_) {
+		close(fd_);
+		throw runtime_error("Can't map history file \"") << fname << "\": " << std::strerror(errno);
+	}
+	char	*base = (char*)map_;
+	hdr_ = (header*)base;
+	ts_ = (int64_t*)(base + l.ts);
+	pid_ = (int32_t*)(base + l.pid);
+	cmd_ = (uint32_t*)(base + l.cmd);
+	af_ = (uint8_t*)(base + l.af);
+	host_ = (uint8_t*)(base + l.host);
+	recv_ = (uint64_t*)(base + l.recv);
+	sent_ = (uint64_t*)(base + l.sent);
+	strs_ = (str_entry*)(base + l.strs);
+	if(!rdonly_) {
+		for(uint64_t i = 0; i < hdr_->str_used; ++i)
+			str_ids_[strs_[i].s] = i;
+	}
+}
+
+nettop::history::~history() {
+	if(MAP_FAILED != map_)
+		munmap(map_, map_sz_);
+	if(-1 != fd_)
+		close(fd_);
+}
+
+uint32_t nettop::history::get_str_id(const std::string& s) {
+	// the table only stores the first STR_SZ-1 chars
+	const std::string	t_s = s.substr(0, STR_SZ-1);
+	auto			it = str_ids_.find(t_s);
+	if(it != str_ids_.end())
+		return it->second;
+	// ids are never recycled, as the rows still referencing
+	// them are only known once they get overwritten
+	if(hdr_->str_used >= hdr_->n_strs) {
+		++hdr_->str_full;
+		return NO_STR;
+	}
+	const uint32_t	id = hdr_->str_used;
+	std::memcpy(strs_[id].s, t_s.c_str(), t_s.length() + 1);
+	__atomic_store_n(&hdr_->str_used, id + 1, __ATOMIC_RELEASE);
+	str_ids_[t_s] = id;
+	return id;
+}
+
+const char* nettop::history::get_str(const uint32_t id) const {
+	if(NO_STR == id)
+		return "(cmdline table full)";
+	if(id >= __atomic_load_n(&hdr_->str_used, __ATOMIC_ACQUIRE))
+		return "(unknown)";
+	return strs_[id].s;
+}
+
+void nettop::history::add_row(const uint64_t row, const int64_t ts, const pid_t pid, const uint32_t cmd, const addr_t* host, const uint64_t recv, const uint64_t sent) {
+	const size_t	idx = row % hdr_->n_rows;
+	ts_[idx] = ts;
+	pid_[idx] = pid;
+	cmd_[idx] = cmd;
+	if(host) {
+		af_[idx] = host->get_af_type();
+		host->get_bytes(&host_[idx*HOST_SZ]);
+	} else {
+		af_[idx] = 0;
+		std::memset(&host_[idx*HOST_SZ], 0x00, HOST_SZ);
+	}
+	recv_[idx] = recv;
+	sent_[idx] = sent;
+}
+
+void nettop::history::append(const std::time_t ts, const ps_vec& p_vec, const bool hosts, const prefix_agg* agg) {
+	if(rdonly_)
+		return;
+	// rows of this interval, at most a whole ring
+	uint64_t	n = 0;
+	for(const auto& p : p_vec) {
+		if(p.total_rs.first || p.total_rs.second)
+			n += 1 + (hosts ? p.addr_rs_map.size() : 0);
+	}
+	n = std::min(n, hdr_->n_rows);
+	// the rows about to be overwritten stop being valid before
+	// we touch them, then the new ones get published all at
+	// once by moving head: readers check tail after reading a
+	// row and drop it if it has been overwritten meanwhile
+	const uint64_t	start = hdr_->head,
+			end = start + n;
+	if(end > hdr_->n_rows && end - hdr_->n_rows > hdr_->tail) {
+		__atomic_store_n(&hdr_->tail, end - hdr_->n_rows, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+	uint64_t	row = start;
+	for(const auto& p : p_vec) {
+		if(row == end)
+			break;
+		if(!p.total_rs.first && !p.total_rs.second)
+			continue;
+		const uint32_t	cmd = get_str_id(p.cmd);
+		add_row(row++, ts, p.pid, cmd, 0, p.total_rs.first, p.total_rs.second);
+		if(!hosts)
+			continue;
+		for(const auto& h : p.addr_rs_map) {
+			if(row == end)
+				break;
+			const addr_t	host = agg ? agg->net_addr(h.first) : h.first;
+			add_row(row++, ts, p.pid, cmd, &host, h.second.recv, h.second.sent);
+		}
+	}
+	__atomic_store_n(&hdr_->head, row, __ATOMIC_RELEASE);
+}
+
+void nettop::history::query(const std::time_t from, const std::time_t to, const size_t n, std::ostream& out) const {
+	const uint64_t	head = __atomic_load_n(&hdr_->head, __ATOMIC_ACQUIRE),
+			n_rows = hdr_->n_rows;
+	// rows are appended with non decreasing timestamps,
+	// binary search the first one in range
+	uint64_t	lo = std::max((head > n_rows) ? head - n_rows : 0, (uint64_t)__atomic_load_n(&hdr_->tail, __ATOMIC_ACQUIRE)),
+			hi = head;
+	while(lo < hi) {
+		const uint64_t	mid = lo + (hi - lo)/2;
+		if(ts_[mid % n_rows] < from)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	typedef std::pair<uint64_t, uint64_t>						rs_pair;
+	typedef std::unordered_map<uint64_t, rs_pair>					procs_map;
+	typedef std::unordered_map<addr_t, rs_pair>					hosts_map;
+	procs_map	procs;
+	hosts_map	hosts;
+	size_t		n_intervals = 0;
+	int64_t		cur_ts = -1,
+			peak_ts = -1;
+	uint64_t	cur_tot = 0,
+			peak_tot = 0;
+	for(uint64_t i = lo; i < head; ++i) {
+		const size_t	idx = i % n_rows;
+		// copy the row, then make sure the writer didn't
+		// start overwriting it while we were reading
+		const int64_t	ts = ts_[idx];
+		const int32_t	pid = pid_[idx];
+		const uint32_t	cmd = cmd_[idx];
+		const uint8_t	af = af_[idx];
+		uint8_t		host[HOST_SZ];
+		std::memcpy(host, &host_[idx*HOST_SZ], HOST_SZ);
+		const uint64_t	recv = recv_[idx],
+				sent = sent_[idx];
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(i < __atomic_load_n(&hdr_->tail, __ATOMIC_RELAXED))
+			continue;
+		if(ts > to)
+			break;
+		if(af) {
+			rs_pair&	r = hosts[addr_t::from_bytes(af, host)];
+			r.first += recv;
+			r.second += sent;
+			continue;
+		}
+		if(ts != cur_ts) {
+			cur_ts = ts;
+			cur_tot = 0;
+			++n_intervals;
+		}
+		cur_tot += recv + sent;
+		if(cur_tot > peak_tot) {
+			peak_tot = cur_tot;
+			peak_ts = cur_ts;
+		}
+		rs_pair&	r = procs[((uint64_t)(uint32_t)pid << 32) | cmd];
+		r.first += recv;
+		r.second += sent;
+	}
+	out << "History from " << time_str(from) << " to " << time_str(to) << " (" << n_intervals << " intervals)" << std::endl;
+	if(peak_ts >= 0)
+		out << "Busiest interval " << time_str(peak_ts) << ", " << bytes_str(peak_tot) << std::endl;
+	if(hdr_->str_full)
+		out << "The cmdline table is full (" << hdr_->n_strs << " entries), " << hdr_->str_full << " rows were written without one" << std::endl;
+	char	buf[256];
+	out << std::endl;
+	std::snprintf(buf, 256, "%-8s  %-48s  %12s  %12s", "PID", "CMDLINE", "RECV", "SENT");
+	out << buf << std::endl;
+	std::vector<std::pair<uint64_t, rs_pair> >	v_procs;
+	top_n(procs, n, v_procs);
+	for(const auto& i : v_procs) {
+		const std::string	cmd = get_str(i.first & 0xFFFFFFFF);
+		std::snprintf(buf, 256, "%-8d  %-48s  %12s  %12s", (int32_t)(i.first >> 32), cmd.substr(0, 48).c_str(), bytes_str(i.second.first).c_str(), bytes_str(i.second.second).c_str());
+		out << buf << std::endl;
+	}
+	if(hosts.empty())
+		return;
+	out << std::endl;
+	std::snprintf(buf, 256, "%-58s  %12s  %12s", "REMOTE HOST", "RECV", "SENT");
+	out << buf << std::endl;
+	std::vector<std::pair<addr_t, rs_pair> >	v_hosts;
+	top_n(hosts, n, v_hosts);
+	for(const auto& i : v_hosts) {
+		std::snprintf(buf, 256, "%-58s  %12s  %12s", i.first.to_str(!settings::NO_RESOLVE).substr(0, 58).c_str(), bytes_str(i.second.first).c_str(), bytes_str(i.second.second).c_str());
+		out << buf << std::endl;
+	}
+}
+
+void nettop::history::parse_query(const std::string& q, std::time_t& from, std::time_t& to, size_t& n) {
+	const std::time_t	now = std::time(0);
+	const size_t		c1 = q.find(','),
+				c2 = (c1 == std::string::npos) ? std::string::npos : q.find(',', c1 + 1);
+	from = parse_time(q.substr(0, c1), now);
+	to = (c1 == std::string::npos) ? now : parse_time(q.substr(c1 + 1, c2 - c1 - 1), now);
+	n = 20;
+	if(c2 != std::string::npos) {
+		const int	n_res = std::atoi(q.c_str() + c2 + 1);
+		if(n_res > 0)
+			n = n_res;
+	}
+	if(from > to)
+		throw runtime_error("Invalid history range, \"") << q << "\" starts after it ends";
+}
@@ -0,0 +1,89 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <string>
+#include <unordered_map>
+#include <ostream>
+#include <stdint.h>
+#include <ctime>
+#include "proc.h"
+
+namespace nettop {
+	// Fixed size ring of per-interval rows stored in a memory
+	// mapped file. Each field is a column (contiguous array) so
+	// that a query only touches the timestamps it needs to find
+	// the range and then the few columns it aggregates.
+	// Cmdlines are kept in a string table and referenced by id.
+	// Appending only writes into the mapping, the kernel flushes
+	// the pages on its own.
+	class history {
+	public:
+		struct header;
+		struct str_entry;
+	private:
+		const bool	rdonly_;
+		int		fd_;
+		void		*map_;
+		size_t		map_sz_;
+		header		*hdr_;
+		// columns
+		int64_t		*ts_;
+		int32_t		*pid_;
+		uint32_t	*cmd_;
+		uint8_t		*af_;		// 0 for the process total row
+		uint8_t		*host_;		// 16 bytes per row
+		uint64_t	*recv_,
+				*sent_;
+		str_entry	*strs_;
+		// cmdline -> id, only for appending
+		std::unordered_map<std::string, uint32_t>	str_ids_;
+
+		uint32_t get_str_id(const std::string& s);
+
+		const char* get_str(const uint32_t id) const;
+
+		void add_row(const uint64_t row, const int64_t ts, const pid_t pid, const uint32_t cmd, const addr_t* host, const uint64_t recv, const uint64_t sent);
+	public:
+		// opens or creates the file, n_rows is only used
+		// when a new file gets created
+		history(const std::string& fname, const size_t n_rows, const bool rdonly);
+
+		~history();
+
+		// one row per process and, if hosts is set, one
+		// row per remote host of each process; hosts aggregated
+		// by agg, when provided, are stored as their network
+		void append(const std::time_t ts, const ps_vec& p_vec, const bool hosts, const prefix_agg* agg = 0);
+
+		// prints the top n processes and hosts by total
+		// traffic with a timestamp in [from, to]
+		void query(const std::time_t from, const std::time_t to, const size_t n, std::ostream& out) const;
+
+		// parses a query string "from[,to[,n]]", times are either
+		// seconds since epoch, negative seconds relative to now,
+		// "YYYY-mm-dd HH:MM[:SS]" or "HH:MM[:SS]" of today
+		static void parse_query(const std::string& q, std::time_t& from, std::time_t& to, size_t& n);
+	};
+}
+
+#endif //_HISTORY_H_
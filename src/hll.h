@@ -0,0 +1,81 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HLL_H_
+#define _HLL_H_
+
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+
+namespace nettop {
+	// HyperLogLog (Flajolet et al.) estimate of the distinct
+	// hashes added, with 2^P registers: about 1.04/sqrt(2^P)
+	// relative error in 2^P bytes, allocated on the first add.
+	// Small cardinalities use linear counting.
+	class hll {
+		static const unsigned	P = 10;
+		static const size_t	M = (size_t)1 << P;
+
+		std::vector<uint8_t>	regs_;
+	public:
+		// h has to be a well mixed 64 bits hash
+		void add(const uint64_t h) {
+			if(regs_.empty())
+				regs_.resize(M);
+			const uint64_t	w = h << P;
+			const uint8_t	rank = w ? __builtin_clzll(w) + 1 : 64 - P + 1;
+			uint8_t&	r = regs_[h >> (64 - P)];
+			if(r < rank)
+				r = rank;
+		}
+
+		void merge(const hll& rhs) {
+			if(rhs.regs_.empty())
+				return;
+			if(regs_.empty()) {
+				regs_ = rhs.regs_;
+				return;
+			}
+			for(size_t i = 0; i < M; ++i) {
+				if(regs_[i] < rhs.regs_[i])
+					regs_[i] = rhs.regs_[i];
+			}
+		}
+
+		size_t estimate(void) const {
+			if(regs_.empty())
+				return 0;
+			double	sum = 0.0;
+			size_t	zeros = 0;
+			for(const auto r : regs_) {
+				sum += std::ldexp(1.0, -(int)r);
+				if(!r)
+					++zeros;
+			}
+			const double	m = M,
+					e = 0.7213/(1.0 + 1.079/m)*m*m/sum;
+			if(e <= 2.5*m && zeros)
+				return (size_t)(m*std::log(m/zeros) + 0.5);
+			return (size_t)(e + 0.5);
+		}
+	};
+}
+
+#endif //_HLL_H_
@@ -0,0 +1,137 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "hosts_sketch.h"
+#include <algorithm>
+
+namespace {
+	size_t next_pow2(const size_t in) {
+		size_t	ret = 1;
+		while(ret < in)
+			ret <<= 1;
+		return ret;
+	}
+
+	// 64 bit finalizer from MurmurHash3
+	inline uint64_t fmix64(uint64_t k) {
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdULL;
+		k ^= k >> 33;
+		k *= 0xc4ceb9fe1a85ec53ULL;
+		k ^= k >> 33;
+		return k;
+	}
+
+	// each row gets its own remix of the address hash
+	inline size_t row_idx(const uint64_t h, const size_t row, const size_t width) {
+		return fmix64(h + row*0x9e3779b97f4a7c15ULL) & (width-1);
+	}
+}
+
+nettop::hosts_sketch::hosts_sketch(const size_t width, const size_t depth, const size_t max_hh, const double decay) : width_(next_pow2(width ? width : 1)), depth_(depth ? depth : 1), max_hh_(max_hh), decay_num_((decay < 0.0) ? 0 : (decay > 1.0) ? 256 : decay*256.0), cnt_(width_*depth_, 0) {
+	hh_.reserve(max_hh_);
+}
+
+uint64_t nettop::hosts_sketch::update(const addr_t& a, const uint64_t len) {
+	const uint64_t	h = a.hash();
+	uint64_t	est = ~((uint64_t)0);
+	uint64_t	*row = &cnt_[0];
+	for(size_t i = 0; i < depth_; ++i, row += width_) {
+		uint64_t&	c = row[row_idx(h, i, width_)];
+		c += len;
+		if(c < est)
+			est = c;
+	}
+	return est;
+}
+
+uint64_t nettop::hosts_sketch::estimate(const addr_t& a) const {
+	const uint64_t	h = a.hash();
+	uint64_t	est = ~((uint64_t)0);
+	const uint64_t	*row = &cnt_[0];
+	for(size_t i = 0; i < depth_; ++i, row += width_) {
+		const uint64_t	c = row[row_idx(h, i, width_)];
+		if(c < est)
+			est = c;
+	}
+	return est;
+}
+
+void nettop::hosts_sketch::offer_hh(const addr_t& a, const uint64_t est) {
+	// the list is small, linear scans are fine
+	size_t		min_idx = 0;
+	for(size_t i = 0; i < hh_.size(); ++i) {
+		if(hh_[i].first == a) {
+			hh_[i].second = est;
+			return;
+		}
+		if(hh_[i].second < hh_[min_idx].second)
+			min_idx = i;
+	}
+	if(hh_.size() < max_hh_) {
+		hh_.push_back(std::make_pair(a, est));
+	} else if(hh_[min_idx].second < est) {
+		hh_[min_idx] = std::make_pair(a, est);
+	}
+}
+
+void nettop::hosts_sketch::add(const addr_t& a, const uint64_t len) {
+	const uint64_t	est = update(a, len);
+	if(max_hh_)
+		offer_hh(a, est);
+}
+
+void nettop::hosts_sketch::set_shards(const size_t n) {
+	shards_.resize(0);
+	for(size_t i = 0; i < n; ++i)
+		shards_.push_back(std::shared_ptr<hosts_sketch>(new hosts_sketch(width_, depth_, max_hh_, 1.0)));
+}
+
+void nettop::hosts_sketch::merge_shards(void) {
+	for(auto& sh : shards_) {
+		uint64_t	*p_sh = &sh->cnt_[0];
+		for(auto& i : cnt_) {
+			i += *p_sh;
+			*p_sh++ = 0;
+		}
+	}
+	// the estimates of current heavy hitters have changed
+	for(auto& i : hh_)
+		i.second = estimate(i.first);
+	// then the heavy hitters of each shard are candidates
+	for(auto& sh : shards_) {
+		for(const auto& i : sh->hh_)
+			offer_hh(i.first, estimate(i.first));
+		sh->hh_.resize(0);
+	}
+}
+
+void nettop::hosts_sketch::decay(void) {
+	const uint64_t	num = decay_num_;
+	for(auto& i : cnt_)
+		i = (i*num) >> 8;
+	for(auto& i : hh_)
+		i.second = (i.second*num) >> 8;
+}
+
+void nettop::hosts_sketch::get_top(hh_vec& out) const {
+	out = hh_;
+	std::sort(out.begin(), out.end(), [](const std::pair<addr_t, uint64_t>& lhs, const std::pair<addr_t, uint64_t>& rhs) { return lhs.second > rhs.second; });
+}
@@ -0,0 +1,74 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _HOSTS_SKETCH_H_
+#define _HOSTS_SKETCH_H_
+
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include "addr_t.h"
+
+namespace nettop {
+	// Count-Min sketch of the traffic per remote host across
+	// all processes, plus a small list of the heavy hitters.
+	// Counters are stored contiguously (depth rows of width
+	// elements) so that updates and decay are plain loops.
+	class hosts_sketch {
+	public:
+		typedef std::vector<std::pair<addr_t, uint64_t> >	hh_vec;
+	private:
+		const size_t		width_,
+					depth_,
+					max_hh_;
+		const uint64_t		decay_num_;	// decay factor in 1/256
+		std::vector<uint64_t>	cnt_;
+		hh_vec			hh_;
+		std::vector<std::shared_ptr<hosts_sketch> >	shards_;
+
+		uint64_t update(const addr_t& a, const uint64_t len);
+
+		uint64_t estimate(const addr_t& a) const;
+
+		void offer_hh(const addr_t& a, const uint64_t est);
+	public:
+		hosts_sketch(const size_t width, const size_t depth, const size_t max_hh, const double decay);
+
+		void add(const addr_t& a, const uint64_t len);
+
+		// for concurrent updates, each thread adds to its own
+		// shard which then gets merged back with merge_shards
+		void set_shards(const size_t n);
+
+		hosts_sketch& get_shard(const size_t i) {
+			return *shards_[i];
+		}
+
+		void merge_shards(void);
+
+		// scales down all the counters, to be called each interval
+		void decay(void);
+
+		// heavy hitters sorted by estimated bytes, descending
+		void get_top(hh_vec& out) const;
+	};
+}
+
+#endif //_HOSTS_SKETCH_H_
@@ -26,14 +26,31 @@
 #include "utils.h"
 #include "cap_mgr.h"
 #include "proc.h"
+#include "binder.h"
+#include "hosts_sketch.h"
+#include "rates.h"
+#include "history.h"
+#include "alerts.h"
+#include "passive_dns.h"
 #include "name_res.h"
 #include "settings.h"
 #include "epoll_stdin.h"
+#include "batch_out.h"
 
 namespace {
 	volatile bool			quit = false,
 					skip_sleep_time = true,
-					paused = false;
+					paused = false,
+					show_stats = false;
+
+	enum view_type {
+		VIEW_HOSTS = 0,
+		VIEW_PORTS,
+		VIEW_CONNS,
+		VIEW_MAX
+	};
+
+	volatile int			view = VIEW_HOSTS;
 
 	void sign_onexit(int param) {
 		quit = true;
@@ -41,90 +58,187 @@ namespace {
 
 	const char*			__version__ = "0.5";
 
-	struct ps_sorted_iter {
-		nettop::ps_vec::const_iterator					it_p_vec;
-		std::vector<nettop::proc_stats::addr_st_map::const_iterator>	v_it_addr;
+	typedef std::pair<nettop::conn_key, nettop::proc_stats::st>	conn_row;
+
+	// rows to display; the arrays are kept across refreshes
+	// and only cleared, so that once they are large enough
+	// sorting doesn't allocate anymore
+	struct sorted_view {
+		struct proc_row {
+			const nettop::proc_stats	*ps;
+			double				key;
+			size_t				first,	// into hosts
+							n;
+		};
+
+		struct host_row {
+			double		key;
+			size_t		idx;	// into addr_rs_map for VIEW_HOSTS, else into conns
+		};
+
+		int			v;	// view the rows were built for
+		std::vector<proc_row>	procs;
+		std::vector<host_row>	hosts;
+		std::vector<conn_row>	conns;
 
-		ps_sorted_iter(nettop::ps_vec::const_iterator it_p_vec_) : it_p_vec(it_p_vec_) {
+		sorted_view() : v(VIEW_HOSTS) {
 		}
 	};
 
-	typedef std::vector<std::shared_ptr<ps_sorted_iter> >		sorted_p_vec;
-
-	void sort_filter_data(const nettop::ps_vec& p_vec, sorted_p_vec& out) {
-		// copy the iterators into output vector
-		out.resize(0);
-		out.reserve(p_vec.size());
-		for(nettop::ps_vec::const_iterator it = p_vec.begin(); it != p_vec.end(); ++it) {
-			std::shared_ptr<ps_sorted_iter>	el(new ps_sorted_iter(it));
-			el->v_it_addr.reserve(it->addr_rs_map.size());
-			for(nettop::proc_stats::addr_st_map::const_iterator it_m = it->addr_rs_map.begin(); it_m != it->addr_rs_map.end(); ++it_m)
-				el->v_it_addr.push_back(it_m);
-			out.push_back(el);
+	// processes and hosts are sorted on the precomputed
+	// rate of the chosen window
+	struct key_order {
+		const bool	top;
+
+		key_order() : top(nettop::settings::ORDER_TOP) {
 		}
-		// filter data if needed
-		if(nettop::settings::FILTER_ZERO) {
-			sorted_p_vec::iterator	it_erase = std::remove_if(out.begin(), out.end(), [](const std::shared_ptr<ps_sorted_iter>& ps){ return (ps->it_p_vec->total_rs.first + ps->it_p_vec->total_rs.second) == 0; });
-			out.erase(it_erase, out.end());
+
+		template<typename T>
+		bool operator()(const T& lhs, const T& rhs) const {
+			return (top) ? lhs.key > rhs.key : lhs.key < rhs.key;
 		}
-		// sort it (external)
-		struct sort_fctr {
-			bool operator()(const std::shared_ptr<ps_sorted_iter>& lhs, const std::shared_ptr<ps_sorted_iter>& rhs) {
-				const size_t	lhs_sz = lhs->it_p_vec->total_rs.first + lhs->it_p_vec->total_rs.second,
-						rhs_sz = rhs->it_p_vec->total_rs.first + rhs->it_p_vec->total_rs.second;
-				return (nettop::settings::ORDER_TOP) ? lhs_sz > rhs_sz : lhs_sz < rhs_sz;
-			}
-		};
-		std::sort(out.begin(), out.end(), sort_fctr());
-		// sort it (internal)
-		struct sort_fctr_int {
-			bool operator()(const nettop::proc_stats::addr_st_map::const_iterator& lhs, const nettop::proc_stats::addr_st_map::const_iterator& rhs) {
-				const size_t	lhs_sz = lhs->second.recv + lhs->second.sent,
-						rhs_sz = rhs->second.recv + rhs->second.sent;
-				return (nettop::settings::ORDER_TOP) ? lhs_sz > rhs_sz : lhs_sz < rhs_sz;
+	};
+
+	struct port_order {
+		bool operator()(const conn_row& lhs, const conn_row& rhs) const {
+			return (lhs.first.r_port != rhs.first.r_port) ? lhs.first.r_port < rhs.first.r_port : lhs.first.t < rhs.first.t;
+		}
+	};
+
+	// only the first top_n processes, and their first top_hosts
+	// hosts, are sorted: the others don't fit on the screen and
+	// keep no hosts; all the processes are still in out, for the totals
+	void sort_filter_data(const nettop::ps_vec& p_vec, sorted_view& out, const size_t top_n, const size_t top_hosts) {
+		out.v = view;
+		out.procs.clear();
+		out.hosts.clear();
+		out.conns.clear();
+		for(const auto& ps : p_vec) {
+			// filter data if needed
+			if(nettop::settings::FILTER_ZERO && (ps.total_rs.first + ps.total_rs.second) == 0)
+				continue;
+			const sorted_view::proc_row	pr = { &ps, ps.rate_rs.first + ps.rate_rs.second, 0, 0 };
+			out.procs.push_back(pr);
+		}
+		const size_t	n_procs = std::min(top_n, out.procs.size());
+		std::partial_sort(out.procs.begin(), out.procs.begin() + n_procs, out.procs.end(), key_order());
+		for(size_t p = 0; p < n_procs; ++p) {
+			sorted_view::proc_row&		pr = out.procs[p];
+			const nettop::proc_stats&	ps = *pr.ps;
+			pr.first = out.hosts.size();
+			switch(out.v) {
+				case VIEW_PORTS: {
+					const size_t	c_first = out.conns.size();
+					for(const auto& i : ps.conn_rs_map)
+						out.conns.push_back(conn_row(nettop::conn_key(addr_t(), i.first.r_port, 0, i.first.t), i.second));
+					// sum up all the connections to the same remote port,
+					// which are now next to each other
+					std::sort(out.conns.begin() + c_first, out.conns.end(), port_order());
+					size_t		c_last = c_first;
+					for(size_t c = c_first + 1; c < out.conns.size(); ++c) {
+						if(out.conns[c].first == out.conns[c_last].first)
+							out.conns[c_last].second += out.conns[c].second;
+						else
+							out.conns[++c_last] = out.conns[c];
+					}
+					if(c_first < out.conns.size())
+						out.conns.erase(out.conns.begin() + c_last + 1, out.conns.end());
+					for(size_t c = c_first; c < out.conns.size(); ++c) {
+						const sorted_view::host_row	hr = { (double)(out.conns[c].second.recv + out.conns[c].second.sent), c };
+						out.hosts.push_back(hr);
+					}
+				} break;
+				case VIEW_CONNS:
+					for(const auto& i : ps.conn_rs_map) {
+						const sorted_view::host_row	hr = { (double)(i.second.recv + i.second.sent), out.conns.size() };
+						out.hosts.push_back(hr);
+						out.conns.push_back(i);
+					}
+					break;
+				default:
+					for(size_t a = 0; a < ps.addr_rs_map.size(); ++a) {
+						const sorted_view::host_row	hr = { ps.addr_rates[a].first + ps.addr_rates[a].second, a };
+						out.hosts.push_back(hr);
+					}
+					break;
 			}
-		};
-		for(auto& i : out) {
-			std::sort(i->v_it_addr.begin(), i->v_it_addr.end(), sort_fctr_int());
+			pr.n = std::min(top_hosts, out.hosts.size() - pr.first);
+			std::partial_sort(out.hosts.begin() + pr.first, out.hosts.begin() + pr.first + pr.n, out.hosts.end(), key_order());
+			out.hosts.resize(pr.first + pr.n);
 		}
 	}
 
 	class curses_setup {
 		WINDOW 			*w_;
 		nettop::name_res&	nr_;
-		const size_t		limit_hosts_;
+		const nettop::prefix_agg	*agg_;
+		const size_t		limit_hosts_,
+					global_hosts_;
+		// what host_str points into
+		std::string		lbl_;
+		nettop::name_res::name_ref	name_;
+		// screen size of the last redraw
+		int			last_row_,
+					last_col_;
+		// time taken by the last redraw
+		std::chrono::nanoseconds	render_tm_;
 
 		static char	BPS[],
 				KBPS[],
 				MBPS[],
 				GBPS[];
 
-		static void recv_send_format(const std::chrono::nanoseconds& tm_elapsed, const size_t recv, const size_t sent, double& recv_d, double& sent_d, const char* & fmt) {
-			const double	tm_fct = 1000000000.0/tm_elapsed.count();
-			const size_t	max_bytes = tm_fct*((recv > sent) ? recv : sent);
+		static std::string port_str(const uint16_t port) {
+			// collapsed ephemeral ports are 0
+			return (port) ? std::to_string(port) : "eph";
+		}
+
+		// aggregated hosts get their network label, without resolving;
+		// valid until the next call
+		const char* host_str(const addr_t& a) {
+			if(agg_ && agg_->label(a, lbl_))
+				return lbl_.c_str();
+			name_ = nr_.lookup(a);
+			return name_.c_str();
+		}
+
+		std::string conn_label(const nettop::conn_key& ck, const int v) {
+			const char*	proto = (ck.t == nettop::packet_stats::type::PACKET_TCP) ? "tcp" : "udp";
+			if(v == VIEW_PORTS)
+				return ":" + port_str(ck.r_port) + "/" + proto;
+			return ":" + port_str(ck.l_port) + " <-> " + nr_.lookup(ck.addr).c_str() + ":" + port_str(ck.r_port) + "/" + proto;
+		}
+
+		static void rate_format(const double recv, const double sent, double& recv_d, double& sent_d, const char* & fmt) {
+			const size_t	max_bytes = (recv > sent) ? recv : sent;
 			if(max_bytes >= 1024*1024*1024) {
 				const double	cnv_fct = 1.0/(1024.0*1024.0*1024.0);
-				recv_d = cnv_fct*recv*tm_fct;
-				sent_d = cnv_fct*sent*tm_fct;
+				recv_d = cnv_fct*recv;
+				sent_d = cnv_fct*sent;
 				fmt = GBPS;
 			} else if(max_bytes >= 1024*1024) {
 				const double	cnv_fct = 1.0/(1024.0*1024.0);
-				recv_d = cnv_fct*recv*tm_fct;
-				sent_d = cnv_fct*sent*tm_fct;
+				recv_d = cnv_fct*recv;
+				sent_d = cnv_fct*sent;
 				fmt = MBPS;
 			} else if(max_bytes >= 1024) {
 				const double	cnv_fct = 1.0/1024.0;
-				recv_d = cnv_fct*recv*tm_fct;
-				sent_d = cnv_fct*sent*tm_fct;
+				recv_d = cnv_fct*recv;
+				sent_d = cnv_fct*sent;
 				fmt = KBPS;
 			} else {
-				recv_d = tm_fct*recv;
-				sent_d = tm_fct*sent;
+				recv_d = recv;
+				sent_d = sent;
 				fmt = BPS;
 			}
 		}
+
+		static void recv_send_format(const std::chrono::nanoseconds& tm_elapsed, const size_t recv, const size_t sent, double& recv_d, double& sent_d, const char* & fmt) {
+			const double	tm_fct = 1000000000.0/tm_elapsed.count();
+			rate_format(tm_fct*recv, tm_fct*sent, recv_d, sent_d, fmt);
+		}
 	public:
-		curses_setup(nettop::name_res& nr, const size_t limit_hosts = 0) : w_(initscr()), nr_(nr), limit_hosts_(limit_hosts) {
+		curses_setup(nettop::name_res& nr, const nettop::prefix_agg* agg = 0, const size_t limit_hosts = 0, const size_t global_hosts = 0) : w_(initscr()), nr_(nr), agg_(agg), limit_hosts_(limit_hosts), global_hosts_(global_hosts), last_row_(-1), last_col_(-1), render_tm_(0) {
 		}
 		
 		~curses_setup() {
@@ -148,11 +262,30 @@ namespace {
 			refresh();
 		}
 	
-		void redraw(const std::chrono::nanoseconds& tm_elapsed, const sorted_p_vec& s_v, const size_t total_pkts, const nettop::proc_mgr::stats& st) {
-			clear();
+		// processes and hosts per process which can be
+		// shown at most, the rest doesn't need sorting
+		void visible(size_t& top_n, size_t& top_hosts) const {
+			int 		row = 0;
+        		int 		col = 0;
+        		getmaxyx(stdscr, row, col);
+			top_n = (row > 0) ? row : 0;
+			top_hosts = (limit_hosts_ && limit_hosts_ < top_n) ? limit_hosts_ : top_n;
+		}
+
+		void redraw(const std::chrono::nanoseconds& tm_elapsed, const sorted_view& s_v, const size_t total_pkts, const nettop::proc_mgr::stats& st, const nettop::hosts_sketch::hh_vec& top_hosts) {
+			const std::chrono::steady_clock::time_point	start = std::chrono::steady_clock::now();
 			int 		row = 0; // number of terminal rows
         		int 		col = 0; // number of terminal columns
         		getmaxyx(stdscr, row, col);      /* find the boundaries of the screeen */
+			// the whole terminal is repainted only after a resize,
+			// otherwise refresh sends just the cells which changed
+			if(row != last_row_ || col != last_col_) {
+				clear();
+				last_row_ = row;
+				last_col_ = col;
+			} else {
+				erase();
+			}
 			// UI coordinates:
 			// 6     2 23                     2 9        2 9        2 5
 			// PIDXXX  cmdlineXXXXXXXXXXXXXXXX  recvXXXXX  sentXXXXX  KiB/s
@@ -163,68 +296,124 @@ namespace {
 			}
 			const size_t	cmdline_len = col - (6+2+9+2+9+2+6+3);
 			int		cur_row = 2;
-			size_t		tot_recv = 0,
-					tot_sent = 0;
+			// the global hosts panel sits at the bottom, if there's space
+			const int	gh_rows = (global_hosts_ && row > (int)global_hosts_ + 1 + 5) ? global_hosts_ + 1 : 0,
+					max_row = row - 1 - gh_rows;
+			double		tot_recv = 0.0,
+					tot_sent = 0.0;
 			// print header
 			attron(A_REVERSE);
-			mvprintw(cur_row++, 0, "%-6s  %-*s  %-9s  %-9s        ", "PID", cmdline_len, "CMDLINE", "RECV", "SENT");
+			static const char*	VIEW_HDRS[VIEW_MAX] = { "CMDLINE", "CMDLINE (ports)", "CMDLINE (connections)" };
+			static const char*	RATE_HDRS[] = { "", " 10s", " 60s", " ewma" };
+			char			recv_hdr[16],
+						sent_hdr[16];
+			std::snprintf(recv_hdr, 16, "RECV%s", RATE_HDRS[nettop::settings::SORT_WINDOW]);
+			std::snprintf(sent_hdr, 16, "SENT%s", RATE_HDRS[nettop::settings::SORT_WINDOW]);
+			mvprintw(cur_row++, 0, "%-6s  %-*s  %-9s  %-9s        ", "PID", cmdline_len, VIEW_HDRS[s_v.v], recv_hdr, sent_hdr);
 			attroff(A_REVERSE);
 			// print each entity
-			for(const auto& sp_i : s_v) {
+			for(const auto& pr : s_v.procs) {
 				// print each process row
-				const auto&	i = *(sp_i->it_p_vec);
+				const auto&	i = *pr.ps;
 				std::string	r_cmd = i.cmd; r_cmd.resize(cmdline_len);
 				double		r_d = 0.0,
 						s_d = 0.0;
 				const char*	fmt = "";
-				recv_send_format(tm_elapsed, i.total_rs.first, i.total_rs.second, r_d, s_d, fmt);
-				tot_recv += i.total_rs.first;
-				tot_sent += i.total_rs.second;
+				rate_format(i.rate_rs.first, i.rate_rs.second, r_d, s_d, fmt);
+				tot_recv += i.rate_rs.first;
+				tot_sent += i.rate_rs.second;
 				// if we don't have more UI space, don't bother printing this row..
-				if(cur_row >= row-1)
+				if(cur_row >= max_row)
 					continue;
 				attron(A_BOLD);
 				mvprintw(cur_row++, 0, "%6d  %-*s %10.2f %10.2f  %-5s", i.pid, cmdline_len, r_cmd.c_str(), r_d, s_d, fmt);
 				attroff(A_BOLD);
-				// print each server txn
-				size_t	cur_hosts = 0;
-				for(const auto& sp_j : sp_i->v_it_addr) {
-					if(limit_hosts_ && cur_hosts >= limit_hosts_) {
-						attron(A_DIM);
-						mvprintw(cur_row++, 0, "           ...");
-						attroff(A_DIM);
+				// print each server txn (or port/connection)
+				size_t		cur_hosts = 0;
+				double		other_recv = i.rate_rs.first,
+						other_sent = i.rate_rs.second;
+				const double	tm_fct = 1000000000.0/tm_elapsed.count();
+				for(size_t h = pr.first; h < pr.first + pr.n; ++h) {
+					if(limit_hosts_ && cur_hosts >= limit_hosts_)
 						break;
-					}
-					const auto&	j = *sp_j;
+					if(cur_row >= max_row)
+						break;
+					const size_t			j_idx = s_v.hosts[h].idx;
+					const nettop::proc_stats::st&	j_st = (s_v.v == VIEW_HOSTS) ? (i.addr_rs_map.begin() + j_idx)->second : s_v.conns[j_idx].second;
+					// ports and connections only have the last interval
+					const std::pair<double, double>	j_r = (s_v.v == VIEW_HOSTS) ? i.addr_rates[j_idx] : std::make_pair(tm_fct*j_st.recv, tm_fct*j_st.sent);
+					other_recv -= j_r.first;
+					other_sent -= j_r.second;
 					const size_t	host_line = cmdline_len-3,
-							tot_t = j.second.udp_t + j.second.tcp_t,
-							udp_p = (tot_t) ? 100.0*j.second.udp_t/(j.second.udp_t + j.second.tcp_t) : 0,
+							tot_t = j_st.udp_t + j_st.tcp_t,
+							udp_p = (tot_t) ? 100.0*j_st.udp_t/(j_st.udp_t + j_st.tcp_t) : 0,
 							tcp_p = (tot_t) ? 100 - udp_p : 0;
 					char		tcp_udp_buf[32] = "[ na/ na] ";
 					if(tot_t) {
 						std::snprintf(tcp_udp_buf, 32, "[%3lu/%3lu] ", tcp_p, udp_p);
 					}
 					char		buf[256];
-					std::snprintf(buf, 256, "%s%s", (nettop::settings::TCP_UDP_TRAFFIC) ? tcp_udp_buf : "", nr_.to_str(j.first).c_str());
+					if(s_v.v == VIEW_HOSTS) {
+						// hosts which could have been replaced in the top-K have an error
+						std::snprintf(buf, 256, "%s%s%s", (nettop::settings::TCP_UDP_TRAFFIC) ? tcp_udp_buf : "", (j_st.err) ? "~" : "", host_str((i.addr_rs_map.begin() + j_idx)->first));
+					} else {
+						std::snprintf(buf, 256, "%s%s%s", (nettop::settings::TCP_UDP_TRAFFIC) ? tcp_udp_buf : "", (j_st.err) ? "~" : "", conn_label(s_v.conns[j_idx].first, s_v.v).c_str());
+					}
 					std::string	r_host = buf; r_host.resize(host_line);
-					recv_send_format(tm_elapsed, j.second.recv, j.second.sent, r_d, s_d, fmt);
+					rate_format(j_r.first, j_r.second, r_d, s_d, fmt);
 					attron(A_DIM);
 					mvprintw(cur_row++, 0, "           %-*s %10.2f %10.2f  %-5s", host_line, r_host.c_str(), r_d, s_d, fmt);
 					attroff(A_DIM);
 					++cur_hosts;
 				}
+				// all the traffic of hosts not displayed or not tracked
+				if((other_recv >= 1.0 || other_sent >= 1.0) && cur_row < max_row) {
+					const size_t	host_line = cmdline_len-3;
+					rate_format(std::max(other_recv, 0.0), std::max(other_sent, 0.0), r_d, s_d, fmt);
+					attron(A_DIM);
+					mvprintw(cur_row++, 0, "           %-*s %10.2f %10.2f  %-5s", (int)host_line, "(other)", r_d, s_d, fmt);
+					attroff(A_DIM);
+				}
+			}
+			// print the global hosts panel
+			if(gh_rows) {
+				int	gh_row = row - gh_rows;
+				attron(A_REVERSE);
+				mvprintw(gh_row++, 0, "%-6s  %-*s  %-9s  %-9s        ", "", (int)cmdline_len, "GLOBAL REMOTE HOSTS (est.)", "TOTAL", "");
+				attroff(A_REVERSE);
+				// the sketch holds the decayed sum of the previous intervals
+				const double	decay_fct = 1.0 - nettop::settings::CMS_DECAY;
+				for(const auto& h : top_hosts) {
+					if(gh_row >= row || !h.second)
+						break;
+					const size_t	host_line = cmdline_len-3;
+					double		r_d = 0.0,
+							s_d = 0.0;
+					const char*	fmt = "";
+					recv_send_format(tm_elapsed, decay_fct*h.second, 0, r_d, s_d, fmt);
+					mvprintw(gh_row++, 0, "           %-*.*s %10.2f %10s  %-5s", (int)host_line, (int)host_line, host_str(h.first), r_d, "", fmt);
+				}
 			}
 			// print the totals and header
 			double		r_d = 0.0,
 					s_d = 0.0;
 			const char*	fmt = "";
-			recv_send_format(tm_elapsed, tot_recv, tot_sent, r_d, s_d, fmt);
+			rate_format(tot_recv, tot_sent, r_d, s_d, fmt);
 			char	total_buf[128];
 			snprintf(total_buf, 128, "%s [%5.2fs (%5lu/%5lu/%5lu/%5lu/%5lu)]", 
 				__version__, 1.0*tm_elapsed.count()/1000000000.0, st.total_pkts, st.total_pkts-st.proc_pkts, st.undet_pkts, st.unmap_r_pkts, st.unmap_s_pkts);
 			mvprintw(0, 0, "nettop %-*s", cmdline_len-6, total_buf);
 			mvprintw(0, cmdline_len+1, "  Total %10.2f %10.2f  %-5s", r_d, s_d, fmt);
+			// internal counters on the spare line
+			if(show_stats) {
+				const nettop::name_res::stats	nr_st = nr_.get_stats();
+				mvprintw(1, 0, "names %lu (hit %lu miss %lu evict %lu expired %lu neg %lu pending %lu passive %lu stored %lu) dropped pkts %lu render %.2fms",
+					nr_st.entries, nr_st.hits, nr_st.misses, nr_st.evictions, nr_st.expired, nr_st.negative, nr_st.in_flight, nr_st.passive, nr_st.stored, st.drop_pkts,
+					render_tm_.count()/1000000.0);
+			}
 			refresh();
+			// shown on the next redraw, as it includes the refresh
+			render_tm_ = std::chrono::steady_clock::now() - start;
 		}
 	};
 
@@ -246,6 +435,17 @@ namespace {
 					paused = !paused;
 					return true;	// do refresh after this!
 					break;
+				case 's':
+					show_stats = !show_stats;
+					return true;
+					break;
+				case 'v':
+					// ports and connections are only there with breakdown
+					if(!nettop::settings::BREAKDOWN)
+						break;
+					view = (view + 1) % VIEW_MAX;
+					return true;
+					break;
 				default:
 					break;
 				}
@@ -269,29 +469,73 @@ int main(int argc, char *argv[]) {
 		std::signal(SIGTERM, sign_onexit);
 		// parse settings and params
 		nettop::parse_args(argc, argv, argv[0], __version__);
+		// only query the history
+		if(!nettop::settings::HISTORY_QUERY.empty()) {
+			if(nettop::settings::HISTORY_FILE.empty())
+				throw nettop::runtime_error("--history-query needs --history to be set");
+			const nettop::history	hist(nettop::settings::HISTORY_FILE, 0, true);
+			std::time_t		from, to;
+			size_t			n;
+			nettop::history::parse_query(nettop::settings::HISTORY_QUERY, from, to, n);
+			hist.query(from, to, n, std::cout);
+			return 0;
+		}
+		// only print a binary log
+		if(!nettop::settings::DECODE_LOG_FILE.empty()) {
+			nettop::async_log::decode(nettop::settings::DECODE_LOG_FILE, nettop::settings::NO_RESOLVE, nettop::settings::NAME_CACHE_FILE, std::cout);
+			return 0;
+		}
 
-		nettop::packet_list		p_list;
+		nettop::packet_list		p_list(nettop::settings::MAX_QUEUED_PKTS);
 		nettop::cap_mgr			c;
-		nettop::local_addr_mgr		lam;
+		nettop::local_addr_mgr		lam(quit);
 		nettop::async_log_list		log_list;
-		nettop::name_res		nr(quit, nettop::settings::NO_RESOLVE);
-		nettop::async_log		al(quit, nr, nettop::settings::ASYNC_LOG_FILE, log_list);
+		nettop::name_res		nr(quit, nettop::settings::NO_RESOLVE, nettop::settings::RESOLVE_THREADS, nettop::settings::RESOLVE_TIMEOUT,
+							   nettop::settings::NAME_CACHE_SIZE, nettop::settings::NAME_TTL, nettop::settings::NAME_NEG_TTL,
+						   nettop::settings::NAME_CACHE_FILE, nettop::settings::RESOLVE_SERVER);
+		nettop::async_log		al(quit, nr, nettop::settings::ASYNC_LOG_FILE, log_list, nettop::settings::ASYNC_LOG_BINARY);
+		// names from the DNS responses in the traffic
+		nettop::dns_list		d_list;
+		std::unique_ptr<nettop::passive_dns>	p_dns;
+		if(nettop::settings::PASSIVE_DNS)
+			p_dns.reset(new nettop::passive_dns(quit, d_list, nr));
 		// create cap thread
-		std::thread			cap_th(&nettop::cap_mgr::async_cap, &c, std::ref(p_list), std::ref(quit));
+		std::thread			cap_th(&nettop::cap_mgr::async_cap, &c, std::ref(p_list), std::ref(quit), p_dns ? &d_list : (nettop::dns_list*)0);
 		cap_th.detach();
-		// init curses
-		curses_setup			c_window(nr, nettop::settings::LIMIT_HOSTS_ROWS);
+		// create binder thread
+		nettop::binder			bnd(quit, p_list, lam, log_list);
+		// init curses, unless only monitoring
+		std::unique_ptr<curses_setup>	c_window;
+		if(!nettop::settings::NO_UI)
+			c_window.reset(new curses_setup(nr, bnd.get_agg(), nettop::settings::LIMIT_HOSTS_ROWS, nettop::settings::GLOBAL_HOSTS_ROWS));
 		system_clock::time_point	latest_time = std::chrono::system_clock::now();
-		// initi epoll_stdin
-		stdin_exit			ep_exit;
+		// rates across refreshes
+		nettop::rates_mgr		rates;
+		// history of the totals
+		std::unique_ptr<nettop::history>	hist;
+		if(!nettop::settings::HISTORY_FILE.empty())
+			hist.reset(new nettop::history(nettop::settings::HISTORY_FILE, nettop::settings::HISTORY_ROWS, false));
+		// alert rules
+		std::unique_ptr<nettop::alert_mgr>	alerts;
+		if(!nettop::settings::ALERT_RULES_FILE.empty())
+			alerts.reset(new nettop::alert_mgr(nettop::settings::ALERT_RULES_FILE));
+		// headless records for other tools
+		std::unique_ptr<nettop::batch_out>	b_out;
+		if(nettop::settings::BATCH_FORMAT)
+			b_out.reset(new nettop::batch_out((nettop::batch_out::format)nettop::settings::BATCH_FORMAT, nettop::settings::BATCH_FILE, nr, bnd.get_agg()));
+		// initi epoll_stdin, without UI stdin could be anything
+		std::unique_ptr<stdin_exit>	ep_exit;
+		if(c_window)
+			ep_exit.reset(new stdin_exit());
 		// automatically set quit to true when
 		// exiting this scope
 		auto_quit	aq_;
+		// rows to display, reused across refreshes
+		sorted_view	s_v;
 		while(!quit) {
-			// initialize all required structures and the processes too
-			nettop::proc_mgr	p_mgr;
-			nettop::proc_mgr::stats	mgr_st;
-			nettop::ps_vec		p_vec;
+			nettop::proc_mgr::stats		mgr_st;
+			nettop::ps_vec			p_vec;
+			nettop::hosts_sketch::hh_vec	top_hosts;
 			// wait for some time
 			if(skip_sleep_time) {
 				skip_sleep_time = false;
@@ -299,31 +543,41 @@ int main(int argc, char *argv[]) {
 				size_t	total_msec_slept = 0;
 				while(!quit && !skip_sleep_time) {
 					const size_t	sleep_interval = 250;
-					if(ep_exit.do_io(sleep_interval))
-						break;
+					if(ep_exit) {
+						if(ep_exit->do_io(sleep_interval))
+							break;
+					} else {
+						std::this_thread::sleep_for(std::chrono::milliseconds(sleep_interval));
+					}
 					total_msec_slept += sleep_interval;
 					if(nettop::settings::REFRESH_SECS <= total_msec_slept/1000)
 						break;
 				}
 			}
-			// bind to known processes
-			const system_clock::time_point 	cur_time = std::chrono::system_clock::now();
-			// bind to local list and stats
-			std::list<nettop::packet_stats>	ps_list;
-			p_list.swap(ps_list);
-			mgr_st.total_pkts = p_list.total_pkts.exchange(0);
-			// get new packets (for the real total counter, we are using an atomic type)
-			// _mostly_ accurate
-			if(!paused) {
-				// bind to known processes
-				p_mgr.bind_packets(ps_list, lam, p_vec, mgr_st, log_list);
-				// sort
-				sorted_p_vec	s_v;
-				sort_filter_data(p_vec, s_v);
-				// redraw now
-				c_window.redraw(cur_time - latest_time, s_v, ps_list.size(), mgr_st);
-			} else {
-				c_window.draw_paused();
+			// take the new processes snapshot outside of the binder lock
+			std::shared_ptr<nettop::proc_mgr>	p_mgr(new nettop::proc_mgr());
+			const system_clock::time_point 		cur_time = std::chrono::system_clock::now();
+			// get the totals bound so far and switch to the new processes
+			bnd.snapshot(p_mgr, p_vec, mgr_st, top_hosts);
+			rates.update(p_vec, 1.0*duration_cast<nanoseconds>(cur_time - latest_time).count()/1000000000.0, (nettop::rate_window)nettop::settings::SORT_WINDOW);
+			if(hist)
+				hist->append(system_clock::to_time_t(cur_time), p_vec, nettop::settings::HISTORY_HOSTS, bnd.get_agg());
+			if(alerts)
+				alerts->eval(p_vec, log_list);
+			if(b_out)
+				b_out->write(cur_time, p_vec, mgr_st);
+			if(c_window) {
+				if(!paused) {
+					// sort
+					size_t		top_n = 0,
+							top_hosts_n = 0;
+					c_window->visible(top_n, top_hosts_n);
+					sort_filter_data(p_vec, s_v, top_n, top_hosts_n);
+					// redraw now
+					c_window->redraw(cur_time - latest_time, s_v, mgr_st.total_pkts, mgr_st, top_hosts);
+				} else {
+					c_window->draw_paused();
+				}
 			}
 			// set latest time
 			latest_time = cur_time;
@@ -18,47 +18,345 @@
 */
 
 #include <memory>
+#include <algorithm>
+#include <ctime>
+#include <resolv.h>
+#include <arpa/inet.h>
+#include <cstdlib>
 #include "name_res.h"
+#include "utils.h"
+
+namespace {
+	// max addresses a worker takes off the queue at once
+	const size_t	MAX_BATCH = 16;
+	// what addr_t::to_str gives back when getnameinfo fails
+	const char	INVALID_HOST[] = "<invalid host>";
+	// how often the names get saved
+	const std::chrono::seconds	SAVE_INTERVAL(300);
+	// how often changes get published
+	const std::chrono::milliseconds	PUBLISH_INTERVAL(100);
+	const uint32_t			NO_NAME = 0xFFFFFFFF;
+}
+
+// Open addressing hash map of the addresses to interned names,
+// only built once and then read. Lookups mark the slots they hit
+// so that the LRU order can be updated without them locking.
+struct nettop::name_res::snapshot {
+	struct slot {
+		addr_t		addr;
+		uint32_t	name;
+	};
+
+	std::vector<slot>			slots;
+	std::vector<std::string>		names;
+	size_t					mask;
+	std::unique_ptr<std::atomic<uint8_t>[]>	touched;
+	clock::time_point			expiry;		// of the first entry to expire
+
+	// leaves out the expired entries, unless already being
+	// resolved again, so that their lookups go through to_str
+	snapshot(const lru_list& lru, const std::unordered_set<addr_t>& in_flight, const clock::time_point now) : expiry(clock::time_point::max()) {
+		size_t	n = 16;
+		while(n < 2*lru.size())
+			n <<= 1;
+		const slot	empty = { addr_t(), NO_NAME };
+		slots.assign(n, empty);
+		mask = n - 1;
+		touched.reset(new std::atomic<uint8_t>[n]);
+		for(size_t i = 0; i < n; ++i)
+			touched[i].store(0, std::memory_order_relaxed);
+		std::unordered_map<std::string, uint32_t>	ids;
+		for(const auto& e : lru) {
+			if(clock::time_point::max() != e.expiry) {
+				if(e.expiry <= now && !in_flight.count(e.addr))
+					continue;
+				if(e.expiry > now)
+					expiry = std::min(expiry, e.expiry);
+			}
+			const auto	id = ids.insert(std::make_pair(e.name, (uint32_t)names.size()));
+			if(id.second)
+				names.push_back(e.name);
+			size_t	i = e.addr.hash() & mask;
+			while(NO_NAME != slots[i].name)
+				i = (i + 1) & mask;
+			slots[i].addr = e.addr;
+			slots[i].name = id.first->second;
+		}
+	}
+
+	const char* find(const addr_t& in) const {
+		for(size_t i = in.hash() & mask; NO_NAME != slots[i].name; i = (i + 1) & mask) {
+			if(slots[i].addr == in) {
+				// don't dirty the cache line each time
+				if(!touched[i].load(std::memory_order_relaxed))
+					touched[i].store(1, std::memory_order_relaxed);
+				return names[slots[i].name].c_str();
+			}
+		}
+		return 0;
+	}
+};
+
+void nettop::name_res::queue(const addr_t& in) {
+	// only one query per address at any time
+	if(in_flight_.insert(in).second) {
+		// bounded as the cache: under a scan the oldest request
+		// is given up, and retried on the next look up
+		if(queue_.size() >= max_entries_) {
+			auto	it = idx_.find(queue_.front());
+			if(idx_.end() != it)
+				it->second->expiry = clock::now();
+			in_flight_.erase(queue_.front());
+			queue_.pop_front();
+		}
+		queue_.push_back(in);
+		cv_.notify_one();
+	}
+}
 
 void nettop::name_res::thread_proc(void) {
+	// the resolver state is per thread, so are its
+	// timeout and name server
+	if(tmout_secs_ || server_.sin_port) {
+		res_init();
+		if(tmout_secs_) {
+			_res.retrans = tmout_secs_;
+			_res.retry = 1;
+		}
+		if(server_.sin_port) {
+			_res.nsaddr_list[0] = server_;
+			_res.nscount = 1;
+		}
+	}
+	std::vector<addr_t>	batch;
+	batch.reserve(MAX_BATCH);
 	while(!exit_) {
-		std::list<addr_t>	lcl_list;
-		list_.swap(lcl_list);
-		for(const auto& i : lcl_list) {
+		{
+			std::unique_lock<std::mutex>	lk(mtx_);
+			// wake up once in a while to check for exit
+			if(!cv_.wait_for(lk, std::chrono::milliseconds(250), [this](){ return !queue_.empty(); }))
+				continue;
+			// take a share of the queue, leaving the rest
+			// to the other workers
+			const size_t	n = std::min(MAX_BATCH, std::max((size_t)1, queue_.size()/thrds_.size()));
+			batch.assign(queue_.begin(), queue_.begin() + n);
+			queue_.erase(queue_.begin(), queue_.begin() + n);
+		}
+		for(const auto& i : batch) {
 			const std::string	full_nm = i.to_str(true);
-			// add into the map
-			{
-				std::lock_guard<std::mutex>	lg(mtx_);
-				addr_map_[i] = full_nm;
-			} 
+			// without a name we get back the address
+			const bool		negative = (full_nm == i.to_str()) || (full_nm == INVALID_HOST);
+			std::lock_guard<std::mutex>	lg(mtx_);
+			in_flight_.erase(i);
+			// it could have been evicted meanwhile
+			auto	it = idx_.find(i);
+			if(idx_.end() == it)
+				continue;
+			// names seen in DNS responses are better
+			if(it->second->passive)
+				continue;
+			if(negative) {
+				++st_.negative;
+			} else {
+				it->second->name = full_nm;
+			}
+			it->second->expiry = clock::now() + (negative ? neg_ttl_ : ttl_);
+			dirty_ = true;
+		}
+	}
+}
+
+void nettop::name_res::save(void) {
+	// convert to wall clock expiries under the lock,
+	// write the file without it
+	name_store::rec_vec	recs;
+	const std::time_t	now = std::time(0);
+	{
+		std::lock_guard<std::mutex>	lg(mtx_);
+		const clock::time_point		c_now = clock::now();
+		recs.reserve(lru_.size());
+		for(const auto& i : lru_) {
+			// not resolved yet
+			if(clock::time_point::max() == i.expiry || i.expiry <= c_now)
+				continue;
+			name_store::record	r;
+			r.addr = i.addr;
+			if(i.name != i.addr.to_str())
+				r.name = i.name;
+			r.expiry = now + std::chrono::duration_cast<std::chrono::seconds>(i.expiry - c_now).count();
+			r.passive = i.passive;
+			recs.push_back(r);
+		}
+	}
+	if(!name_store::save(store_fname_, recs, max_entries_, now))
+		return;
+	std::unique_ptr<name_store>	n_store(new name_store(store_fname_));
+	std::lock_guard<std::mutex>	lg(mtx_);
+	store_.swap(n_store);
+}
+
+void nettop::name_res::publish(void) {
+	const std::shared_ptr<const snapshot>	cur = std::atomic_load(&snap_);
+	std::lock_guard<std::mutex>	lg(mtx_);
+	const clock::time_point		now = clock::now();
+	if(cur) {
+		for(size_t i = 0; i < cur->slots.size(); ++i) {
+			if(!cur->touched[i].load(std::memory_order_relaxed))
+				continue;
+			cur->touched[i].store(0, std::memory_order_relaxed);
+			auto	it = idx_.find(cur->slots[i].addr);
+			if(idx_.end() != it)
+				lru_.splice(lru_.begin(), lru_, it->second);
 		}
-		std::this_thread::sleep_for(std::chrono::milliseconds(250));
+		// expired entries have to go through to_str
+		if(now >= cur->expiry)
+			dirty_ = true;
 	}
+	if(!dirty_ && cur)
+		return;
+	dirty_ = false;
+	// the replaced one is freed by its last reader
+	std::atomic_store(&snap_, std::shared_ptr<const snapshot>(new snapshot(lru_, in_flight_, now)));
 }
 
-nettop::name_res::name_res(volatile bool& e, bool do_not_resolve) : exit_(e) {
-	thrd_ = std::shared_ptr<std::thread>(do_not_resolve ? 0 : new std::thread(&name_res::thread_proc, this));
+void nettop::name_res::maint_proc(void) {
+	clock::time_point	next_save = clock::now() + SAVE_INTERVAL;
+	while(!exit_) {
+		std::this_thread::sleep_for(PUBLISH_INTERVAL);
+		publish();
+		if(store_fname_.empty() || clock::now() < next_save)
+			continue;
+		save();
+		next_save = clock::now() + SAVE_INTERVAL;
+	}
+	if(!store_fname_.empty())
+		save();
+}
+
+nettop::name_res::name_res(volatile bool& e, bool do_not_resolve, const size_t n_threads, const size_t tmout_secs, const size_t max_entries, const size_t ttl_secs, const size_t neg_ttl_secs, const std::string& store_fname, const std::string& server) : exit_(e), tmout_secs_(tmout_secs), max_entries_(std::max((size_t)1, max_entries)), ttl_(std::chrono::seconds(ttl_secs)), neg_ttl_(std::chrono::seconds(neg_ttl_secs)), server_(sockaddr_in()), dirty_(false), snap_hits_(0), store_fname_(store_fname) {
+	if(!server.empty()) {
+		const size_t		p_colon = server.find(':');
+		const std::string	ip = server.substr(0, p_colon);
+		const int		port = (std::string::npos == p_colon) ? 53 : std::atoi(server.c_str() + p_colon + 1);
+		if(1 != inet_pton(AF_INET, ip.c_str(), &server_.sin_addr) || port < 1 || port > 65535)
+			throw runtime_error("Invalid DNS server (expected 'ipv4[:port]' but found '") << server << "')";
+		server_.sin_family = AF_INET;
+		server_.sin_port = htons(port);
+	}
+	if(!store_fname_.empty())
+		store_.reset(new name_store(store_fname_));
+	maint_thrd_ = std::shared_ptr<std::thread>(new std::thread(&name_res::maint_proc, this));
+	if(do_not_resolve)
+		return;
+	// all the workers have to be there before any starts
+	std::lock_guard<std::mutex>	lg(mtx_);
+	for(size_t i = 0; i < std::max((size_t)1, n_threads); ++i)
+		thrds_.push_back(std::shared_ptr<std::thread>(new std::thread(&name_res::thread_proc, this)));
+}
+
+nettop::name_res::lru_list::iterator nettop::name_res::insert(const addr_t& in) {
+	entry	e;
+	e.addr = in;
+	e.name = in.to_str();
+	e.expiry = clock::time_point::max();
+	e.passive = false;
+	lru_.push_front(e);
+	dirty_ = true;
+	idx_[in] = lru_.begin();
+	if(lru_.size() > max_entries_) {
+		idx_.erase(lru_.back().addr);
+		lru_.pop_back();
+		++st_.evictions;
+	}
+	return lru_.begin();
 }
 
 std::string nettop::name_res::to_str(const addr_t& in) {
-	// if we don't have a running thread
+	// try to find if we have it
+	std::lock_guard<std::mutex>	lg(mtx_);
+	auto				it = idx_.find(in);
+	if(idx_.end() != it) {
+		++st_.hits;
+		lru_.splice(lru_.begin(), lru_, it->second);
+		if(clock::now() > it->second->expiry && !in_flight_.count(in)) {
+			++st_.expired;
+			// let the reverse lookup replace the passive name
+			it->second->passive = false;
+			dirty_ = true;
+			// keep on showing the old name while getting the new one
+			if(thrds_.empty()) {
+				it->second->name = in.to_str();
+				it->second->expiry = clock::time_point::max();
+			} else
+				queue(in);
+		}
+		return it->second->name;
+	}
+	// resolved in a previous run
+	if(store_) {
+		name_store::record	r;
+		const std::time_t	now = std::time(0);
+		if(store_->find(in, now, r)) {
+			++st_.stored;
+			lru_list::iterator	e = insert(in);
+			if(!r.name.empty())
+				e->name = r.name;
+			e->passive = r.passive;
+			e->expiry = clock::now() + std::chrono::seconds(r.expiry - now);
+			return e->name;
+		}
+	}
+	// if we don't have running threads
 	// just return the IP address
-	if (!thrd_)
+	if(thrds_.empty())
 		return in.to_str();
-	// try to find if we have it
+	++st_.misses;
+	// the address is shown until the name is there
+	const std::string	nm = insert(in)->name;
+	queue(in);
+	return nm;
+}
+
+void nettop::name_res::set_name(const addr_t& in, const std::string& name) {
 	std::lock_guard<std::mutex>	lg(mtx_);
-	auto				it = addr_map_.find(in);
-	if(addr_map_.end() == it) {
-		const std::string	nm = in.to_str();
-		addr_map_[in] = nm;
-		list_.push(in);
-		return nm;
+	auto				it = idx_.find(in);
+	lru_list::iterator		e = (idx_.end() == it) ? insert(in) : it->second;
+	e->name = name;
+	e->passive = true;
+	e->expiry = clock::now() + ttl_;
+	++st_.passive;
+	dirty_ = true;
+}
+
+nettop::name_res::name_ref nettop::name_res::lookup(const addr_t& in) {
+	name_ref	ret;
+	ret.snap_ = std::atomic_load(&snap_);
+	if(ret.snap_ && (ret.p_ = ret.snap_->find(in))) {
+		snap_hits_.fetch_add(1, std::memory_order_relaxed);
+		return ret;
 	}
-	return it->second;
+	ret.snap_.reset();
+	// nothing to wait for, nor to look up
+	if(thrds_.empty() && store_fname_.empty())
+		ret.slow_ = in.to_num_str();
+	else
+		ret.slow_ = to_str(in);
+	return ret;
 }
 
-nettop::name_res::~name_res() {
-	if(thrd_)
-		thrd_->join();
+nettop::name_res::stats nettop::name_res::get_stats(void) {
+	std::lock_guard<std::mutex>	lg(mtx_);
+	stats	ret = st_;
+	ret.hits += snap_hits_.load(std::memory_order_relaxed);
+	ret.entries = lru_.size();
+	ret.in_flight = in_flight_.size();
+	return ret;
 }
 
+nettop::name_res::~name_res() {
+	cv_.notify_all();
+	for(auto& i : thrds_)
+		i->join();
+	if(maint_thrd_)
+		maint_thrd_->join();
+}
@@ -21,30 +21,139 @@
 #define _NAME_RES_H_
 
 #include "addr_t.h"
-#include "mt_list.h"
+#include "name_store.h"
 #include <thread>
 #include <string>
 #include <mutex>
-#include <map>
+#include <condition_variable>
+#include <list>
+#include <chrono>
+#include <unordered_map>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <unordered_set>
+#include <atomic>
+#include <netinet/in.h>
 
 namespace nettop {
-	typedef mt_list<addr_t>		async_addr_list;
-
+	// Asynchronous reverse lookups with a bounded LRU cache
+	// of the names; entries expire after a ttl, which is shorter
+	// for addresses without a name.
+	// Changes to the cache are published in batches as an
+	// immutable snapshot, swapped atomically, so that lookup()
+	// doesn't take the cache lock nor allocate for the known names.
 	class name_res {
 		name_res(const name_res&) = delete;
 		name_res& operator=(const name_res&) = delete;
+	public:
+		struct stats {
+			size_t	entries,
+				hits,
+				misses,
+				evictions,
+				expired,
+				negative,
+				in_flight,
+				passive,
+				stored;		// found in the store file
+
+			stats() : entries(0), hits(0), misses(0), evictions(0), expired(0), negative(0), in_flight(0), passive(0), stored(0) {
+			}
+		};
+
+		struct snapshot;
+
+		// name of an address: points into a snapshot, which it
+		// keeps alive, or holds its own copy when lookup() had to lock
+		class name_ref {
+			friend class name_res;
+
+			std::shared_ptr<const snapshot>	snap_;
+			const char			*p_;
+			std::string			slow_;
+		public:
+			name_ref() : p_(0) {
+			}
+
+			const char* c_str(void) const {
+				return p_ ? p_ : slow_.c_str();
+			}
+		};
+	private:
+		typedef std::chrono::steady_clock	clock;
+
+		struct entry {
+			addr_t			addr;
+			std::string		name;
+			clock::time_point	expiry;
+			bool			passive;	// seen in a DNS response
+		};
+
+		typedef std::list<entry>						lru_list;
+		typedef std::unordered_map<addr_t, lru_list::iterator>			lru_idx;
 
 		volatile bool&			exit_;
-		async_addr_list			list_;
-		std::shared_ptr<std::thread>	thrd_;
+		const size_t			tmout_secs_,
+						max_entries_;
+		const clock::duration		ttl_,
+						neg_ttl_;
+		sockaddr_in			server_;	// sin_port 0 when not set
 		std::mutex			mtx_;
-		std::map<addr_t, std::string>	addr_map_;
+		std::condition_variable		cv_;
+		std::deque<addr_t>		queue_;
+		std::unordered_set<addr_t>	in_flight_;	// queued or being resolved
+		lru_list			lru_;		// most recently used first
+		lru_idx				idx_;
+		stats				st_;
+		bool				dirty_;		// cache changed since the last snapshot
+		// only accessed with std::atomic_load/atomic_store
+		std::shared_ptr<const snapshot>	snap_;
+		std::atomic<size_t>		snap_hits_;
+		std::vector<std::shared_ptr<std::thread> >	thrds_;
+		const std::string		store_fname_;
+		std::unique_ptr<name_store>	store_;
+		std::shared_ptr<std::thread>	maint_thrd_;
+
+		void queue(const addr_t& in);
+
+		// writes the current names to the store file
+		void save(void);
+
+		// replaces the snapshot if the cache changed, first
+		// moving the entries looked up in it to the LRU front
+		void publish(void);
+
+		// publishes and saves
+		void maint_proc(void);
+
+		// new entry showing the address, evicting the oldest if needed
+		lru_list::iterator insert(const addr_t& in);
 		
 		void thread_proc(void);
 public:
-		name_res(volatile bool& e, bool do_not_resolve);
+		// resolves with n_threads workers, each lookup giving
+		// up after about tmout_secs (0 for the system default);
+		// keeps up to max_entries names for ttl_secs, or
+		// neg_ttl_secs for the addresses which have none;
+		// names are saved to store_fname, if not empty,
+		// periodically and on exit, and looked up there
+		// before being resolved again; server, as 'ipv4[:port]',
+		// replaces the name servers of the system when not empty
+		name_res(volatile bool& e, bool do_not_resolve, const size_t n_threads = 1, const size_t tmout_secs = 0, const size_t max_entries = 16384, const size_t ttl_secs = 600, const size_t neg_ttl_secs = 60, const std::string& store_fname = "", const std::string& server = "");
 
 		std::string to_str(const addr_t& in);
+
+		// as to_str, but without taking the cache lock when in
+		// is in the current snapshot; c_str() of the result stays
+		// valid for as long as the result
+		name_ref lookup(const addr_t& in);
+
+		// name learnt passively, it takes precedence over the
+		// reverse lookups until it expires
+		void set_name(const addr_t& in, const std::string& name);
+
+		stats get_stats(void);
 		
 		~name_res();
 	};
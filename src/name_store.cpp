@@ -0,0 +1,191 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "name_store.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <unordered_set>
+
+namespace {
+	const char	MAGIC[8] = { 'N', 'T', 'N', 'A', 'M', 'E', '0', '1' };
+	const uint32_t	VERSION = 1;
+	const uint8_t	FLAG_PASSIVE = 0x01;
+	const size_t	MAX_NAME = 0xFFFF;
+}
+
+struct nettop::name_store::header {
+	char		magic[8];
+	uint32_t	version,
+			rec_sz;
+	uint64_t	n_recs,
+			names_sz;
+};
+
+struct nettop::name_store::file_rec {
+	uint8_t		addr[16];
+	int64_t		expiry;
+	uint32_t	name_off;
+	uint16_t	name_len;
+	uint8_t		af;
+	uint8_t		flags;
+};
+
+nettop::name_store::name_store(const std::string& fname) : map_(0), map_sz_(0), hdr_(0), recs_(0), names_(0) {
+	const int	fd = open(fname.c_str(), O_RDONLY);
+	if(-1 == fd)
+		return;
+	struct stat	st;
+	if(!fstat(fd, &st) && (size_t)st.st_size >= sizeof(header)) {
+		map_ = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if(MAP_FAILED == map_)
+			map_ = 0;
+		else
+			map_sz_ = st.st_size;
+	}
+	// the mapping stays valid without the fd
+	close(fd);
+	if(!map_)
+		return;
+	const header	*h = (const header*)map_;
+	if(std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) || h->version != VERSION || h->rec_sz != sizeof(file_rec) ||
+	   h->n_recs > (map_sz_ - sizeof(header))/sizeof(file_rec) ||
+	   h->names_sz != map_sz_ - sizeof(header) - h->n_recs*sizeof(file_rec)) {
+		munmap(map_, map_sz_);
+		map_ = 0;
+		map_sz_ = 0;
+		return;
+	}
+	hdr_ = h;
+	recs_ = (const file_rec*)((const char*)map_ + sizeof(header));
+	names_ = (const char*)(recs_ + h->n_recs);
+}
+
+nettop::name_store::~name_store() {
+	if(map_)
+		munmap(map_, map_sz_);
+}
+
+void nettop::name_store::get(const file_rec& r, record& out) const {
+	out.addr = addr_t::from_bytes(r.af, r.addr);
+	// never trust the offsets
+	if((uint64_t)r.name_off + r.name_len <= hdr_->names_sz)
+		out.name.assign(names_ + r.name_off, r.name_len);
+	else
+		out.name.clear();
+	out.expiry = r.expiry;
+	out.passive = r.flags & FLAG_PASSIVE;
+}
+
+bool nettop::name_store::find(const addr_t& in, const std::time_t now, record& out) const {
+	if(!hdr_)
+		return false;
+	size_t	lo = 0,
+		hi = hdr_->n_recs;
+	while(lo < hi) {
+		const size_t	mid = lo + (hi - lo)/2;
+		const addr_t	cur = addr_t::from_bytes(recs_[mid].af, recs_[mid].addr);
+		if(cur < in) {
+			lo = mid + 1;
+		} else if(in < cur) {
+			hi = mid;
+		} else {
+			if(recs_[mid].expiry <= now)
+				return false;
+			get(recs_[mid], out);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool nettop::name_store::save(const std::string& fname, const rec_vec& recs, const size_t max_recs, const std::time_t now) {
+	struct sort_fctr {
+		bool operator()(const record* lhs, const record* rhs) const {
+			return lhs->addr < rhs->addr;
+		}
+	};
+	// the given records first, then what's still valid
+	std::vector<const record*>	all;
+	std::unordered_set<addr_t>	seen;
+	for(const auto& i : recs) {
+		if(all.size() >= max_recs)
+			break;
+		if(i.expiry > now && seen.insert(i.addr).second)
+			all.push_back(&i);
+	}
+	const name_store	old(fname);
+	rec_vec			old_recs;
+	if(old.hdr_) {
+		old_recs.reserve(std::min((size_t)old.hdr_->n_recs, max_recs));
+		record	r;
+		for(uint64_t i = 0; i < old.hdr_->n_recs && all.size() + old_recs.size() < max_recs; ++i) {
+			if(old.recs_[i].expiry <= now)
+				continue;
+			old.get(old.recs_[i], r);
+			if(!seen.count(r.addr))
+				old_recs.push_back(r);
+		}
+	}
+	// old_recs won't grow anymore, pointers are stable
+	for(const auto& i : old_recs)
+		all.push_back(&i);
+	std::sort(all.begin(), all.end(), sort_fctr());
+	// records and names as laid out in the file
+	std::vector<file_rec>	f_recs(all.size());
+	std::string		names;
+	for(size_t i = 0; i < all.size(); ++i) {
+		file_rec&		fr = f_recs[i];
+		const size_t		len = std::min(MAX_NAME, all[i]->name.size());
+		std::memset(&fr, 0x00, sizeof(fr));
+		all[i]->addr.get_bytes(fr.addr);
+		fr.af = all[i]->addr.get_af_type();
+		fr.expiry = all[i]->expiry;
+		fr.name_off = names.size();
+		fr.name_len = len;
+		fr.flags = all[i]->passive ? FLAG_PASSIVE : 0;
+		names.append(all[i]->name, 0, len);
+	}
+	header	hdr;
+	std::memset(&hdr, 0x00, sizeof(hdr));
+	std::memcpy(hdr.magic, MAGIC, sizeof(MAGIC));
+	hdr.version = VERSION;
+	hdr.rec_sz = sizeof(file_rec);
+	hdr.n_recs = f_recs.size();
+	hdr.names_sz = names.size();
+	// readers (even old mappings) never see a partial file
+	const std::string	tmp_fname = fname + ".tmp";
+	FILE			*f = std::fopen(tmp_fname.c_str(), "wb");
+	if(!f)
+		return false;
+	bool	ok = (1 == std::fwrite(&hdr, sizeof(hdr), 1, f)) &&
+		     (f_recs.empty() || f_recs.size() == std::fwrite(&f_recs[0], sizeof(file_rec), f_recs.size(), f)) &&
+		     (names.empty() || 1 == std::fwrite(names.data(), names.size(), 1, f));
+	ok = !std::fclose(f) && ok;
+	if(!ok || std::rename(tmp_fname.c_str(), fname.c_str())) {
+		std::remove(tmp_fname.c_str());
+		return false;
+	}
+	return true;
+}
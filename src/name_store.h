@@ -0,0 +1,74 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _NAME_STORE_H_
+#define _NAME_STORE_H_
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <stdint.h>
+#include "addr_t.h"
+
+namespace nettop {
+	// Host names saved across runs in a read only memory mapped
+	// file: fixed size records sorted by address, followed by the
+	// names. Lookups binary search the mapping, so only the pages
+	// actually needed get read. Expiries are wall clock times.
+	class name_store {
+		name_store(const name_store&) = delete;
+		name_store& operator=(const name_store&) = delete;
+	public:
+		struct record {
+			addr_t		addr;
+			std::string	name;		// empty when it has none
+			std::time_t	expiry;
+			bool		passive;
+		};
+
+		typedef std::vector<record>	rec_vec;
+
+		struct header;
+		struct file_rec;
+	private:
+		void		*map_;
+		size_t		map_sz_;
+		const header	*hdr_;
+		const file_rec	*recs_;
+		const char	*names_;
+
+		void get(const file_rec& r, record& out) const;
+	public:
+		// a missing or invalid file is just an empty store
+		explicit name_store(const std::string& fname);
+
+		~name_store();
+
+		// true if in is there and not expired at now
+		bool find(const addr_t& in, const std::time_t now, record& out) const;
+
+		// writes recs and, after those, the records of the
+		// current file still valid at now, up to max_recs;
+		// the new file replaces the old one atomically
+		static bool save(const std::string& fname, const rec_vec& recs, const size_t max_recs, const std::time_t now);
+	};
+}
+
+#endif //_NAME_STORE_H_
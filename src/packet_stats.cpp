@@ -21,31 +21,125 @@
 #include <algorithm>
 #include <ifaddrs.h>
 #include <list>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include "utils.h"
 
-nettop::local_addr_mgr::local_addr_mgr() {
+void nettop::local_addr_mgr::load_ifaddrs(void) {
 	struct ifaddrs		*ifaddr = 0, 
 				*ifa = 0;
         int  			n = 0;
 
 	if(-1 == getifaddrs(&ifaddr))
 		throw runtime_error("Failure in getifaddrs");
+	addrs_.clear();
 	for (ifa = ifaddr, n = 0; ifa != NULL; ifa = ifa->ifa_next, n++) {
 		if (ifa->ifa_addr == NULL)
                 	continue;
 		const int family = ifa->ifa_addr->sa_family;
 		if (family == AF_INET) {
 			const struct sockaddr_in	*sa = (struct sockaddr_in*)ifa->ifa_addr;
-			local_addrs_.insert(addr_t(sa->sin_addr));
+			addrs_.insert(addr_t(sa->sin_addr));
 		} else if(family == AF_INET6) {
 			const struct sockaddr_in6	*sa = (struct sockaddr_in6*)ifa->ifa_addr;
-			local_addrs_.insert(addr_t(sa->sin6_addr));
+			addrs_.insert(addr_t(sa->sin6_addr));
 		}
 	}
 	freeifaddrs(ifaddr);
 }
 
-bool nettop::local_addr_mgr::is_local(const addr_t& in) const {
-	return local_addrs_.find(in) != local_addrs_.end();
+void nettop::local_addr_mgr::publish(void) {
+	std::atomic_store(&cur_, set_ptr(new addr_set(addrs_.begin(), addrs_.end())));
 }
 
+bool nettop::local_addr_mgr::on_nl_data(const char* buf, size_t len) {
+	bool	changed = false;
+	for(const struct nlmsghdr *nh = (const struct nlmsghdr*)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+		if(nh->nlmsg_type != RTM_NEWADDR && nh->nlmsg_type != RTM_DELADDR)
+			continue;
+		const struct ifaddrmsg	*ifa = (const struct ifaddrmsg*)NLMSG_DATA(nh);
+		int			rta_len = IFA_PAYLOAD(nh);
+		const struct rtattr	*rta_addr = 0;
+		for(const struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, rta_len); rta = RTA_NEXT(rta, rta_len)) {
+			// for ipv4 IFA_ADDRESS is the peer on point to point links
+			if(rta->rta_type == IFA_LOCAL || (rta->rta_type == IFA_ADDRESS && !rta_addr))
+				rta_addr = rta;
+		}
+		if(!rta_addr)
+			continue;
+		addr_t	a;
+		if(ifa->ifa_family == AF_INET && RTA_PAYLOAD(rta_addr) >= sizeof(in_addr))
+			a = addr_t(*(const in_addr*)RTA_DATA(rta_addr));
+		else if(ifa->ifa_family == AF_INET6 && RTA_PAYLOAD(rta_addr) >= sizeof(in6_addr))
+			a = addr_t(*(const in6_addr*)RTA_DATA(rta_addr));
+		else
+			continue;
+		if(nh->nlmsg_type == RTM_NEWADDR)
+			changed |= addrs_.insert(a).second;
+		else
+			changed |= addrs_.erase(a) > 0;
+	}
+	return changed;
+}
+
+void nettop::local_addr_mgr::thread_proc(void) {
+	char	buf[16384];
+	bool	reload = false;
+	while(!exit_) {
+		struct pollfd	pfd = { nl_fd_, POLLIN, 0 };
+		const int	rv = poll(&pfd, 1, 250);
+		if(reload) {
+			// when it fails the current set is kept,
+			// and we try again at the next poll
+			try {
+				load_ifaddrs();
+				publish();
+				reload = false;
+			} catch(const std::exception&) {
+			}
+		}
+		if(rv <= 0)
+			continue;
+		const ssize_t	len = recv(nl_fd_, buf, sizeof(buf), 0);
+		if(len < 0) {
+			// we lost some notifications, start over
+			if(errno == ENOBUFS)
+				reload = true;
+			continue;
+		}
+		if(on_nl_data(buf, len))
+			publish();
+	}
+}
+
+nettop::local_addr_mgr::local_addr_mgr(volatile bool& e) : exit_(e), nl_fd_(-1) {
+	// subscribe first, so that nothing gets lost in between
+	nl_fd_ = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE);
+	if(-1 != nl_fd_) {
+		struct sockaddr_nl	sa;
+		std::memset(&sa, 0x00, sizeof(sa));
+		sa.nl_family = AF_NETLINK;
+		sa.nl_groups = RTMGRP_IPV4_IFADDR|RTMGRP_IPV6_IFADDR;
+		if(bind(nl_fd_, (struct sockaddr*)&sa, sizeof(sa))) {
+			close(nl_fd_);
+			nl_fd_ = -1;
+		}
+	}
+	load_ifaddrs();
+	publish();
+	// without notifications the addresses stay the ones at startup
+	if(-1 != nl_fd_)
+		thrd_ = std::shared_ptr<std::thread>(new std::thread(&local_addr_mgr::thread_proc, this));
+}
+
+nettop::local_addr_mgr::~local_addr_mgr() {
+	if(thrd_)
+		thrd_->join();
+	if(-1 != nl_fd_)
+		close(nl_fd_);
+}
@@ -22,6 +22,11 @@
 
 #include "addr_t.h"
 #include <set>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <iterator>
 
 namespace nettop {
 
@@ -48,12 +53,76 @@ namespace nettop {
 		}
 	};
 
+	// Immutable open addressing hash set of addresses, only
+	// built once and then read
+	class addr_set {
+		std::vector<addr_t>	slots_;
+		std::vector<uint8_t>	used_;
+		size_t			mask_;
+	public:
+		template<typename It>
+		addr_set(It begin, It end) {
+			size_t	n = 16;
+			while(n < 2*(size_t)std::distance(begin, end))
+				n <<= 1;
+			slots_.resize(n);
+			used_.resize(n);
+			mask_ = n - 1;
+			for(; begin != end; ++begin) {
+				size_t	i = begin->hash() & mask_;
+				while(used_[i] && !(slots_[i] == *begin))
+					i = (i + 1) & mask_;
+				slots_[i] = *begin;
+				used_[i] = 1;
+			}
+		}
+
+		bool contains(const addr_t& in) const {
+			for(size_t i = in.hash() & mask_; used_[i]; i = (i + 1) & mask_) {
+				if(slots_[i] == in)
+					return true;
+			}
+			return false;
+		}
+	};
+
+	// Local addresses, kept up to date with the rtnetlink address
+	// notifications. Each update publishes a new immutable set,
+	// readers take a reference to the current one and the
+	// replaced ones are freed when their last reader is done.
 	class local_addr_mgr {
-		std::set<addr_t>	local_addrs_;
+		local_addr_mgr(const local_addr_mgr&) = delete;
+		local_addr_mgr& operator=(const local_addr_mgr&) = delete;
 	public:
-		local_addr_mgr();
+		typedef std::shared_ptr<const addr_set>	set_ptr;
+	private:
+		volatile bool&			exit_;
+		std::set<addr_t>		addrs_;		// only used by the update thread
+		set_ptr				cur_;		// only accessed with std::atomic_load/atomic_store
+		int				nl_fd_;
+		std::shared_ptr<std::thread>	thrd_;
+
+		void load_ifaddrs(void);
+
+		void publish(void);
+
+		bool on_nl_data(const char* buf, size_t len);
+
+		void thread_proc(void);
+	public:
+		local_addr_mgr(volatile bool& e);
+
+		// the current set, to be kept for a whole batch
+		// of lookups rather than taken for each one
+		set_ptr get(void) const {
+			return std::atomic_load(&cur_);
+		}
+
+		bool is_local(const addr_t& in) const {
+			return get()->contains(in);
+		}
 
-		bool is_local(const addr_t& in) const;
+		~local_addr_mgr();
 	};
 }
 
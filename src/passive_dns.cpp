@@ -0,0 +1,144 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "passive_dns.h"
+#include <cstring>
+#include <vector>
+#include <chrono>
+#include <arpa/inet.h>
+#include "addr_t.h"
+
+namespace {
+	const uint16_t	DNS_TYPE_A = 1,
+			DNS_TYPE_AAAA = 28,
+			DNS_CLASS_IN = 1;
+	const size_t	DNS_HDR_SZ = 12,
+			MAX_LABELS = 128;
+
+	inline uint16_t get_u16(const uint8_t *p) {
+		return (((uint16_t)p[0]) << 8) | p[1];
+	}
+
+	// reads the name at off, following the compression pointers; on
+	// success off points right after the name as written in place
+	bool read_name(const uint8_t *msg, const size_t len, size_t& off, std::string& name) {
+		size_t	cur = off,
+			n_labels = 0;
+		bool	jumped = false;
+		name.clear();
+		while(cur < len) {
+			const uint8_t	l = msg[cur];
+			if(0 == l) {
+				if(!jumped)
+					off = cur + 1;
+				return true;
+			}
+			if(++n_labels > MAX_LABELS)
+				return false;
+			if(0xC0 == (l & 0xC0)) {
+				if(cur + 1 >= len)
+					return false;
+				if(!jumped)
+					off = cur + 2;
+				jumped = true;
+				cur = ((l & 0x3F) << 8) | msg[cur + 1];
+				continue;
+			}
+			// 0x40 and 0x80 are reserved
+			if(l & 0xC0)
+				return false;
+			if(cur + 1 + l > len)
+				return false;
+			if(!name.empty())
+				name += '.';
+			name.append((const char*)msg + cur + 1, l);
+			cur += 1 + l;
+		}
+		return false;
+	}
+}
+
+size_t nettop::passive_dns::parse(const std::string& msg, name_res& nr) {
+	const uint8_t	*p = (const uint8_t*)msg.data();
+	const size_t	len = msg.size();
+	if(len < DNS_HDR_SZ)
+		return 0;
+	const uint16_t	flags = get_u16(p + 2),
+			qd_cnt = get_u16(p + 4),
+			an_cnt = get_u16(p + 6);
+	// only successful responses to a single question
+	if(!(flags & 0x8000) || (flags & 0x000F) || 1 != qd_cnt)
+		return 0;
+	size_t		off = DNS_HDR_SZ;
+	std::string	qname;
+	if(!read_name(p, len, off, qname) || qname.empty() || off + 4 > len)
+		return 0;
+	off += 4;
+	size_t		ret = 0;
+	std::string	rname;
+	for(uint16_t i = 0; i < an_cnt; ++i) {
+		if(!read_name(p, len, off, rname) || off + 10 > len)
+			break;
+		const uint16_t	type = get_u16(p + off),
+				cls = get_u16(p + off + 2),
+				rd_len = get_u16(p + off + 8);
+		off += 10;
+		if(off + rd_len > len)
+			break;
+		// CNAMEs are skipped, the records they point to
+		// still get named after what has been asked
+		if(DNS_CLASS_IN == cls) {
+			if(DNS_TYPE_A == type && 4 == rd_len) {
+				struct in_addr	a;
+				std::memcpy(&a, p + off, 4);
+				nr.set_name(addr_t(a), qname);
+				++ret;
+			} else if(DNS_TYPE_AAAA == type && 16 == rd_len) {
+				struct in6_addr	a;
+				std::memcpy(&a, p + off, 16);
+				nr.set_name(addr_t(a), qname);
+				++ret;
+			}
+		}
+		off += rd_len;
+	}
+	return ret;
+}
+
+void nettop::passive_dns::thread_proc(void) {
+	std::vector<std::string>	cur;
+	while(!exit_) {
+		// any response is worth waking up for, the
+		// timeout is only to check exit_
+		list_.pop_many(cur, 1, std::chrono::milliseconds(250));
+		for(const auto& i : cur)
+			parse(i, nr_);
+		cur.clear();
+	}
+}
+
+nettop::passive_dns::passive_dns(volatile bool& e, dns_list& list, name_res& nr) : exit_(e), list_(list), nr_(nr) {
+	thrd_ = std::shared_ptr<std::thread>(new std::thread(&passive_dns::thread_proc, this));
+}
+
+nettop::passive_dns::~passive_dns() {
+	if(thrd_)
+		thrd_->join();
+}
@@ -17,41 +17,36 @@
 *	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#ifndef _MT_LIST_H_
-#define _MT_LIST_H_
-
-#include <mutex>
-#include <list>
-#include <algorithm>
-
-template<typename T>
-class mt_list {
-	
-	mt_list(const mt_list&) = delete;
-	mt_list& operator=(const mt_list&) = delete;
-	
-	std::mutex	mtx_;
-	std::list<T>	list_;
-public:
-	mt_list() {}
 
-	~mt_list() {}
+#ifndef _PASSIVE_DNS_H_
+#define _PASSIVE_DNS_H_
+
+#include <memory>
+#include <string>
+#include <thread>
+#include "cap_mgr.h"
+#include "name_res.h"
 
-	void push(const T& in) {
-		std::lock_guard<std::mutex>	lg(mtx_);
-		list_.push_back(in);
-	}
+namespace nettop {
+	class passive_dns {
+		passive_dns(const passive_dns&) = delete;
+		passive_dns& operator=(const passive_dns&) = delete;
 
-	void push_many(const std::list<T>& in) {
-		std::lock_guard<std::mutex>	lg(mtx_);
-		std::for_each(in.begin(), in.end(), [&](const T& t){ list_.push_back(t); });
-	}
+		volatile bool&			exit_;
+		dns_list&			list_;
+		name_res&			nr_;
+		std::shared_ptr<std::thread>	thrd_;
+
+		void thread_proc(void);
+public:
+		passive_dns(volatile bool& e, dns_list& list, name_res& nr);
 
-	void swap(std::list<T>& out) {
-		std::lock_guard<std::mutex>	lg(mtx_);
-		list_.swap(out);
-	}
-};
+		// parses a single DNS response and names each A/AAAA record
+		// after the question; returns how many names have been set
+		static size_t parse(const std::string& msg, name_res& nr);
 
-#endif //_MT_LIST_H_
+		~passive_dns();
+	};
+}
 
+#endif //_PASSIVE_DNS_H_
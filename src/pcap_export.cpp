@@ -0,0 +1,311 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "pcap_export.h"
+#include "utils.h"
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+
+namespace {
+	// packets queued at most between two batches
+	const size_t	MAX_QUEUE = 65536;
+	// old files kept when rotating
+	const size_t	MAX_ROTATED = 4;
+	// link layer header included in packet_stats::len
+	const size_t	SLL_HDR_SZ = 16;
+	const uint32_t	SHB_TYPE = 0x0A0D0D0A,
+			IDB_TYPE = 0x00000001,
+			EPB_TYPE = 0x00000006,
+			BYTE_ORDER_MAGIC = 0x1A2B3C4D;
+	const uint16_t	LINKTYPE_RAW = 101,
+			OPT_ENDOFOPT = 0,
+			OPT_COMMENT = 1,
+			SHB_USERAPPL = 4,
+			IF_NAME = 2;
+	const char*	VERDICT_STR[] = { "UNDET", "UNMAP_R", "UNMAP_S", "recv", "sent" };
+
+	inline size_t pad4(const size_t sz) {
+		return (sz + 3) & ~(size_t)3;
+	}
+
+	template<typename T>
+	inline void put(std::vector<char>& buf, const T& v) {
+		const char	*p = (const char*)&v;
+		buf.insert(buf.end(), p, p + sizeof(T));
+	}
+
+	void put_opt(std::vector<char>& buf, const uint16_t code, const std::string& v) {
+		put(buf, code);
+		put(buf, (uint16_t)v.size());
+		buf.insert(buf.end(), v.begin(), v.end());
+		buf.resize(pad4(buf.size()));
+	}
+
+	// fixes the total length at both ends of the block starting at start
+	void close_block(std::vector<char>& buf, const size_t start) {
+		const uint32_t	len = buf.size() - start + sizeof(uint32_t);
+		std::memcpy(&buf[start + sizeof(uint32_t)], &len, sizeof(len));
+		put(buf, len);
+	}
+
+	uint16_t ip_csum(const uint8_t* p, const size_t len) {
+		uint32_t	sum = 0;
+		for(size_t i = 0; i < len; i += 2)
+			sum += (p[i] << 8) | p[i+1];
+		while(sum >> 16)
+			sum = (sum & 0xFFFF) + (sum >> 16);
+		return ~sum;
+	}
+
+	inline void put_be16(uint8_t* p, const uint16_t v) {
+		p[0] = v >> 8;
+		p[1] = v & 0xFF;
+	}
+
+	// ip and tcp/udp headers only, returns their length
+	size_t synth_headers(uint8_t* p, const addr_t& src, const addr_t& dst, const uint16_t p_src, const uint16_t p_dst, const bool tcp, size_t ip_len) {
+		const size_t	l4_sz = tcp ? 20 : 8;
+		size_t		ip_sz = src.is_ipv4() ? 20 : 40;
+		ip_len = std::max(ip_len, ip_sz + l4_sz);
+		if(src.is_ipv4()) {
+			std::memset(p, 0x00, ip_sz);
+			p[0] = 0x45;
+			put_be16(p + 2, std::min(ip_len, (size_t)0xFFFF));
+			p[8] = 64;
+			p[9] = tcp ? IPPROTO_TCP : IPPROTO_UDP;
+			uint8_t	b[16];
+			src.get_bytes(b);
+			std::memcpy(p + 12, b, 4);
+			dst.get_bytes(b);
+			std::memcpy(p + 16, b, 4);
+			put_be16(p + 10, ip_csum(p, ip_sz));
+		} else {
+			std::memset(p, 0x00, ip_sz);
+			p[0] = 0x60;
+			put_be16(p + 4, std::min(ip_len - ip_sz, (size_t)0xFFFF));
+			p[6] = tcp ? IPPROTO_TCP : IPPROTO_UDP;
+			p[7] = 64;
+			src.get_raw_bytes(p + 8);
+			dst.get_raw_bytes(p + 24);
+		}
+		uint8_t	*l4 = p + ip_sz;
+		std::memset(l4, 0x00, l4_sz);
+		put_be16(l4, p_src);
+		put_be16(l4 + 2, p_dst);
+		if(tcp)
+			l4[12] = 5 << 4;
+		else
+			put_be16(l4 + 4, std::min(ip_len - ip_sz, (size_t)0xFFFF));
+		return ip_sz + l4_sz;
+	}
+
+	bool write_all(const int fd, struct iovec* iov, int n) {
+		while(n > 0) {
+			const ssize_t	rv = writev(fd, iov, n);
+			if(-1 == rv) {
+				if(EINTR == errno)
+					continue;
+				return false;
+			}
+			size_t	left = rv;
+			while(n > 0 && left >= iov->iov_len) {
+				left -= iov->iov_len;
+				++iov;
+				--n;
+			}
+			if(n > 0) {
+				iov->iov_base = (char*)iov->iov_base + left;
+				iov->iov_len -= left;
+			}
+		}
+		return true;
+	}
+}
+
+bool nettop::pcap_export::rotate(void) {
+	if(-1 != fd_) {
+		close(fd_);
+		for(size_t i = MAX_ROTATED; i > 1; --i)
+			std::rename((fname_ + "." + std::to_string(i-1)).c_str(), (fname_ + "." + std::to_string(i)).c_str());
+		std::rename(fname_.c_str(), (fname_ + ".1").c_str());
+	}
+	fd_ = open(fname_.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	f_bytes_ = 0;
+	return -1 != fd_;
+}
+
+void nettop::pcap_export::append_block(const pkt_rec& r, size_t& dropped) {
+	uint8_t		hdrs[60];
+	const size_t	ip_len = (r.len > SLL_HDR_SZ) ? r.len - SLL_HDR_SZ : 0,
+			cap_len = synth_headers(hdrs, r.src, r.dst, r.p_src, r.p_dst, packet_stats::type::PACKET_TCP == r.proto, ip_len),
+			orig_len = std::max(ip_len, cap_len);
+	const uint64_t	ts_us = r.ts*1000000.0;
+	const size_t	start = buf_.size();
+	put(buf_, EPB_TYPE);
+	put(buf_, (uint32_t)0);
+	put(buf_, (uint32_t)0);
+	put(buf_, (uint32_t)(ts_us >> 32));
+	put(buf_, (uint32_t)(ts_us & 0xFFFFFFFF));
+	put(buf_, (uint32_t)cap_len);
+	put(buf_, (uint32_t)orig_len);
+	buf_.insert(buf_.end(), (const char*)hdrs, (const char*)hdrs + cap_len);
+	buf_.resize(pad4(buf_.size()));
+	char	cmt[128];
+	if(r.v >= PROC_R)
+		std::snprintf(cmt, sizeof(cmt), "nettop: %s pid %d (%s)", VERDICT_STR[r.v], (int)r.pid, r.cmd);
+	else if(r.v == UNMAP_R || r.v == UNMAP_S)
+		std::snprintf(cmt, sizeof(cmt), "nettop: %s (kernel)", VERDICT_STR[r.v]);
+	else
+		std::snprintf(cmt, sizeof(cmt), "nettop: %s", VERDICT_STR[r.v]);
+	put_opt(buf_, OPT_COMMENT, cmt);
+	if(dropped) {
+		put_opt(buf_, OPT_COMMENT, "nettop: " + std::to_string(dropped) + " packets dropped before this one");
+		dropped = 0;
+	}
+	put(buf_, OPT_ENDOFOPT);
+	put(buf_, (uint16_t)0);
+	close_block(buf_, start);
+}
+
+void nettop::pcap_export::write_batch(rec_vec& recs) {
+	size_t	dropped = 0;
+	{
+		std::lock_guard<std::mutex>	lg(mtx_);
+		queue_.swap(recs);
+		std::swap(dropped, dropped_);
+	}
+	dropped += failed_;
+	failed_ = 0;
+	if(recs.empty()) {
+		failed_ = dropped;
+		return;
+	}
+	const size_t	n_recs = recs.size();
+	buf_.clear();
+	for(const auto& i : recs)
+		append_block(i, dropped);
+	recs.clear();
+	// a failed write drops the batch, not nettop
+	// a single batch bigger than max_bytes_ still gets written
+	if((-1 == fd_ || (f_bytes_ && f_bytes_ + buf_.size() > max_bytes_)) && !rotate()) {
+		failed_ = n_recs;
+		return;
+	}
+	// a new file first gets its section and interface
+	std::vector<char>	hdr;
+	if(!f_bytes_) {
+		size_t	start = hdr.size();
+		put(hdr, SHB_TYPE);
+		put(hdr, (uint32_t)0);
+		put(hdr, BYTE_ORDER_MAGIC);
+		put(hdr, (uint16_t)1);
+		put(hdr, (uint16_t)0);
+		put(hdr, (int64_t)-1);
+		put_opt(hdr, SHB_USERAPPL, "nettop");
+		put(hdr, OPT_ENDOFOPT);
+		put(hdr, (uint16_t)0);
+		close_block(hdr, start);
+		start = hdr.size();
+		put(hdr, IDB_TYPE);
+		put(hdr, (uint32_t)0);
+		put(hdr, LINKTYPE_RAW);
+		put(hdr, (uint16_t)0);
+		put(hdr, (uint32_t)0);
+		put_opt(hdr, IF_NAME, "nettop");
+		put(hdr, OPT_ENDOFOPT);
+		put(hdr, (uint16_t)0);
+		close_block(hdr, start);
+	}
+	struct iovec	iov[2];
+	int		n = 0;
+	if(!hdr.empty()) {
+		iov[n].iov_base = &hdr[0];
+		iov[n++].iov_len = hdr.size();
+	}
+	iov[n].iov_base = &buf_[0];
+	iov[n++].iov_len = buf_.size();
+	if(!write_all(fd_, iov, n)) {
+		failed_ = n_recs;
+		return;
+	}
+	f_bytes_ += hdr.size() + buf_.size();
+}
+
+void nettop::pcap_export::thread_proc(void) {
+	// swapped with queue_, so neither ever reallocates
+	rec_vec	recs;
+	recs.reserve(MAX_QUEUE);
+	while(!exit_) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(250));
+		write_batch(recs);
+	}
+	write_batch(recs);
+}
+
+nettop::pcap_export::pcap_export(volatile bool& e, const std::string& fname, const size_t max_bytes, const pid_t pid) : exit_(e), fname_(fname), max_bytes_(max_bytes), pid_(pid), dropped_(0), failed_(0), fd_(-1), f_bytes_(0) {
+	queue_.reserve(MAX_QUEUE);
+	if(!rotate())
+		throw runtime_error("Can't open pcapng file \"") << fname_ << "\": " << std::strerror(errno);
+	thrd_ = std::shared_ptr<std::thread>(new std::thread(&pcap_export::thread_proc, this));
+}
+
+void nettop::pcap_export::append(rec_vec& out, const packet_stats& ps, const verdict v, const pid_t pid, const std::string* cmd) {
+	out.push_back(pkt_rec());
+	pkt_rec&	r = out.back();
+	r.ts = ps.ts;
+	r.src = ps.src;
+	r.dst = ps.dst;
+	r.p_src = ps.p_src;
+	r.p_dst = ps.p_dst;
+	r.len = ps.len;
+	r.proto = ps.t;
+	r.v = v;
+	r.pid = pid;
+	r.cmd[0] = '\0';
+	if(cmd)
+		std::snprintf(r.cmd, sizeof(r.cmd), "%s", cmd->c_str());
+}
+
+void nettop::pcap_export::add(rec_vec& recs) {
+	if(recs.empty())
+		return;
+	{
+		std::lock_guard<std::mutex>	lg(mtx_);
+		const size_t	n = std::min(recs.size(), MAX_QUEUE - std::min(MAX_QUEUE, queue_.size()));
+		queue_.insert(queue_.end(), recs.begin(), recs.begin() + n);
+		dropped_ += recs.size() - n;
+	}
+	recs.clear();
+}
+
+nettop::pcap_export::~pcap_export() {
+	if(thrd_)
+		thrd_->join();
+	if(-1 != fd_)
+		close(fd_);
+}
@@ -0,0 +1,112 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _PCAP_EXPORT_H_
+#define _PCAP_EXPORT_H_
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <sys/types.h>
+#include "packet_stats.h"
+
+namespace nettop {
+	// Writes the packets which couldn't be attributed, and the
+	// ones of a chosen pid, to a pcapng file. Only the packet
+	// metadata is captured, so each packet gets synthesized
+	// ip and tcp/udp headers (LINKTYPE_RAW) with its original
+	// length, plus a comment with the attribution decision.
+	// Packets are queued in a bounded buffer and written by a
+	// separate thread in batches, so binding never waits on the
+	// disk; when the file grows past max_bytes it is rotated
+	// into fname.1, fname.2 and so on.
+	class pcap_export {
+		pcap_export(const pcap_export&) = delete;
+		pcap_export& operator=(const pcap_export&) = delete;
+	public:
+		enum verdict {
+			UNDET = 0,
+			UNMAP_R,
+			UNMAP_S,
+			PROC_R,
+			PROC_S
+		};
+
+		struct pkt_rec {
+			double		ts;
+			addr_t		src,
+					dst;
+			uint16_t	p_src,
+					p_dst;
+			uint32_t	len;
+			uint8_t		proto,
+					v;
+			pid_t		pid;
+			char		cmd[64];
+		};
+
+		typedef std::vector<pkt_rec>	rec_vec;
+	private:
+		volatile bool&			exit_;
+		const std::string		fname_;
+		const size_t			max_bytes_;
+		const pid_t			pid_;
+		std::mutex			mtx_;
+		rec_vec				queue_;
+		size_t				dropped_,
+						failed_;	// packets to note, writer only
+		int				fd_;
+		size_t				f_bytes_;
+		std::vector<char>		buf_;
+		std::shared_ptr<std::thread>	thrd_;
+
+		// closes the current file, if any, shifts the old
+		// ones and opens a new one
+		bool rotate(void);
+
+		// the first block after drops notes them
+		void append_block(const pkt_rec& r, size_t& dropped);
+
+		void write_batch(rec_vec& recs);
+
+		void thread_proc(void);
+	public:
+		// pid < 0 for no process
+		pcap_export(volatile bool& e, const std::string& fname, const size_t max_bytes, const pid_t pid);
+
+		bool want_pid(const pid_t pid) const {
+			return pid_ >= 0 && pid == pid_;
+		}
+
+		// appends a record to out, which is then queued with add;
+		// lets each binding thread take the lock only once
+		static void append(rec_vec& out, const packet_stats& ps, const verdict v, const pid_t pid = -1, const std::string* cmd = 0);
+
+		// thread safe, queues all of recs under a single lock and
+		// drops what doesn't fit; recs is cleared
+		void add(rec_vec& recs);
+
+		~pcap_export();
+	};
+}
+
+#endif //_PCAP_EXPORT_H_
@@ -0,0 +1,240 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "prefix_agg.h"
+#include "utils.h"
+#include <fstream>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <sstream>
+#include <arpa/inet.h>
+
+namespace {
+	inline int get_bit(const unsigned char* k, const size_t i) {
+		return (k[i>>3] >> (7 - (i&7))) & 0x01;
+	}
+
+	// zeroes all the bits from len onwards
+	void mask_bits(unsigned char* k, const size_t len) {
+		for(size_t i = len; i < 128; ++i)
+			k[i>>3] &= ~(0x80 >> (i&7));
+	}
+
+	size_t common_bits(const unsigned char* a, const unsigned char* b, const size_t max_len) {
+		size_t	i = 0;
+		while(i + 8 <= max_len && a[i>>3] == b[i>>3])
+			i += 8;
+		while(i < max_len && get_bit(a, i) == get_bit(b, i))
+			++i;
+		return i;
+	}
+
+	int fam_idx(const addr_t& a) {
+		switch(a.get_af_type()) {
+			case AF_INET:
+				return 0;
+			case AF_INET6:
+				return 1;
+		}
+		return -1;
+	}
+
+	const size_t	FAM_BITS[2] = { 32, 128 };
+	// keys of the user networks are encoded in the discard
+	// prefix 100::/64 (RFC 6666), which never carries traffic
+	const unsigned char	DISCARD_PFX[8] = { 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+}
+
+nettop::prefix_trie::node::node(const unsigned char* key_, const size_t len_, const int entry_) : len(len_), entry(entry_) {
+	std::memcpy(key, key_, sizeof(key));
+	mask_bits(key, len);
+}
+
+nettop::prefix_trie::prefix_trie() : root_{ node(DISCARD_PFX, 0, -1), node(DISCARD_PFX, 0, -1) } {
+}
+
+void nettop::prefix_trie::insert(const addr_t& net, const size_t len, const int entry) {
+	const int	f = fam_idx(net);
+	if(f < 0)
+		return;
+	unsigned char	k[16];
+	net.get_bytes(k);
+	mask_bits(k, len);
+	node		*n = &root_[f];
+	if(!len) {
+		n->entry = entry;
+		return;
+	}
+	while(true) {
+		std::unique_ptr<node>&	c = n->child[get_bit(k, n->len)];
+		if(!c) {
+			c.reset(new node(k, len, entry));
+			return;
+		}
+		const size_t	cpl = common_bits(c->key, k, std::min(c->len, len));
+		if(cpl == c->len) {
+			if(c->len == len) {
+				c->entry = entry;
+				return;
+			}
+			n = c.get();
+			continue;
+		}
+		// split the child where the prefixes diverge
+		std::unique_ptr<node>	mid(new node(k, cpl, -1)),
+					old(c.release());
+		const int		o_bit = get_bit(old->key, cpl);
+		mid->child[o_bit] = std::move(old);
+		if(cpl == len)
+			mid->entry = entry;
+		else
+			mid->child[get_bit(k, cpl)].reset(new node(k, len, entry));
+		c = std::move(mid);
+		return;
+	}
+}
+
+int nettop::prefix_trie::match(const addr_t& a) const {
+	const int	f = fam_idx(a);
+	if(f < 0)
+		return -1;
+	unsigned char	k[16];
+	a.get_bytes(k);
+	const node	*n = &root_[f];
+	int		best = n->entry;
+	while(n->len < FAM_BITS[f]) {
+		const node	*c = n->child[get_bit(k, n->len)].get();
+		if(!c || common_bits(c->key, k, c->len) < c->len)
+			break;
+		if(c->entry >= 0)
+			best = c->entry;
+		n = c;
+	}
+	return best;
+}
+
+nettop::prefix_agg::prefix_agg(const size_t v4_len, const size_t v6_len, const std::string& cidr_file) : v4_len_(v4_len), v6_len_(v6_len) {
+	if(cidr_file.empty())
+		return;
+	std::ifstream	istr(cidr_file.c_str());
+	if(!istr)
+		throw runtime_error("Can't open CIDR file \"") << cidr_file << "\"";
+	std::string	line;
+	size_t		n_line = 0;
+	while(std::getline(istr, line)) {
+		++n_line;
+		const size_t	c_pos = line.find('#');
+		if(c_pos != std::string::npos)
+			line.resize(c_pos);
+		std::istringstream	iss(line);
+		std::string		cidr,
+					name;
+		if(!(iss >> cidr))
+			continue;
+		std::getline(iss >> std::ws, name);
+		while(!name.empty() && std::isspace(name[name.size()-1]))
+			name.resize(name.size()-1);
+		// parse the network
+		const size_t	s_pos = cidr.find('/');
+		const std::string	net_s = cidr.substr(0, s_pos);
+		unsigned char	b[16] = {0};
+		int		af = AF_INET;
+		if(1 != inet_pton(AF_INET, net_s.c_str(), b)) {
+			af = AF_INET6;
+			if(1 != inet_pton(AF_INET6, net_s.c_str(), b))
+				throw runtime_error("Invalid network \"") << net_s << "\" in CIDR file \"" << cidr_file << "\" at line " << n_line;
+		}
+		const size_t	max_len = (af == AF_INET) ? 32 : 128;
+		size_t		len = max_len;
+		if(s_pos != std::string::npos) {
+			char		*end = 0;
+			const long	l = std::strtol(cidr.c_str() + s_pos + 1, &end, 10);
+			if(*end || l < 0 || (size_t)l > max_len)
+				throw runtime_error("Invalid prefix length in \"") << cidr << "\" in CIDR file \"" << cidr_file << "\" at line " << n_line;
+			len = l;
+		}
+		entry	e;
+		e.name = name.empty() ? cidr : name;
+		mask_bits(b, len);
+		e.net = addr_t::from_bytes(af, b);
+		e.len = len;
+		trie_.insert(addr_t::from_bytes(af, b), len, entries_.size());
+		entries_.push_back(e);
+	}
+}
+
+addr_t nettop::prefix_agg::map(const addr_t& a) const {
+	const int	e = trie_.match(a);
+	if(e >= 0) {
+		unsigned char	b[16] = {0};
+		std::memcpy(b, DISCARD_PFX, sizeof(DISCARD_PFX));
+		b[12] = (e >> 24) & 0xFF;
+		b[13] = (e >> 16) & 0xFF;
+		b[14] = (e >> 8) & 0xFF;
+		b[15] = e & 0xFF;
+		return addr_t::from_bytes(AF_INET6, b);
+	}
+	const size_t	len = a.is_ipv6() ? v6_len_ : v4_len_;
+	if(!len || fam_idx(a) < 0)
+		return a;
+	unsigned char	b[16];
+	a.get_bytes(b);
+	mask_bits(b, len);
+	return addr_t::from_bytes(a.get_af_type(), b);
+}
+
+int nettop::prefix_agg::find_entry(const addr_t& key) const {
+	if(!key.is_ipv6() || entries_.empty())
+		return -1;
+	unsigned char	b[16];
+	key.get_bytes(b);
+	if(std::memcmp(b, DISCARD_PFX, sizeof(DISCARD_PFX)))
+		return -1;
+	const size_t	e = ((size_t)b[12] << 24) | ((size_t)b[13] << 16) | ((size_t)b[14] << 8) | b[15];
+	return (e < entries_.size()) ? (int)e : -1;
+}
+
+bool nettop::prefix_agg::label(const addr_t& key, std::string& out) const {
+	const int	e = find_entry(key);
+	if(e >= 0) {
+		out = entries_[e].name;
+		return true;
+	}
+	return net_str(key, out);
+}
+
+addr_t nettop::prefix_agg::net_addr(const addr_t& key) const {
+	const int	e = find_entry(key);
+	return (e >= 0) ? entries_[e].net : key;
+}
+
+bool nettop::prefix_agg::net_str(const addr_t& key, std::string& out) const {
+	const int	e = find_entry(key);
+	if(e >= 0) {
+		out = entries_[e].net.to_str() + "/" + std::to_string(entries_[e].len);
+		return true;
+	}
+	const size_t	len = key.is_ipv6() ? v6_len_ : v4_len_;
+	if(!len || fam_idx(key) < 0)
+		return false;
+	out = key.to_str() + "/" + std::to_string(len);
+	return true;
+}
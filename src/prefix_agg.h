@@ -0,0 +1,92 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _PREFIX_AGG_H_
+#define _PREFIX_AGG_H_
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <stdint.h>
+#include "addr_t.h"
+
+namespace nettop {
+	// Path compressed binary trie of network prefixes, one per
+	// address family, returning the longest prefix matching an
+	// address. Each node stores its whole prefix so that chains
+	// of single children collapse into one node.
+	class prefix_trie {
+		struct node {
+			unsigned char		key[16];
+			size_t			len;
+			int			entry;	// -1 when only a branching node
+			std::unique_ptr<node>	child[2];
+
+			node(const unsigned char* key_, const size_t len_, const int entry_);
+		};
+
+		node	root_[2];	// ipv4, ipv6
+	public:
+		prefix_trie();
+
+		void insert(const addr_t& net, const size_t len, const int entry);
+
+		// index of the longest matching entry, -1 if none
+		int match(const addr_t& a) const;
+	};
+
+	// Maps remote hosts to the key they get accounted under:
+	// the user supplied network they belong to, or the address
+	// truncated to a fixed prefix length per family
+	class prefix_agg {
+		struct entry {
+			std::string	name;
+			addr_t		net;
+			size_t		len;
+		};
+
+		prefix_trie		trie_;
+		std::vector<entry>	entries_;
+		const size_t		v4_len_,
+					v6_len_;	// 0 to keep the addresses
+
+		// entry a key returned by map stands for, -1 if none
+		int find_entry(const addr_t& key) const;
+	public:
+		// cidr_file has lines 'a.b.c.d/n [name]', '#' starts a comment
+		prefix_agg(const size_t v4_len, const size_t v6_len, const std::string& cidr_file);
+
+		addr_t map(const addr_t& a) const;
+
+		// display string of a key returned by map, false for
+		// plain addresses
+		bool label(const addr_t& key, std::string& out) const;
+
+		// network address of a key returned by map, as the keys
+		// of the networks listed in the file are only internal
+		addr_t net_addr(const addr_t& key) const;
+
+		// 'address/len' of a key returned by map, false for
+		// plain addresses
+		bool net_str(const addr_t& key, std::string& out) const;
+	};
+}
+
+#endif //_PREFIX_AGG_H_
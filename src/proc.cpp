@@ -31,7 +31,6 @@
 #include <fcntl.h>
 #include <map>
 #include <set>
-#include <sstream>
 
 namespace {
 
@@ -170,45 +169,94 @@ namespace {
 		for(auto& i : out)
 			std::sort(i.second.begin(), i.second.end());
 	}
+}
 
-	// async log events
-	struct log_evt : public nettop::async_line {
-		enum type {
-			UNDET = 0,
-			UNMAP_R,
-			UNMAP_S
-		};
+namespace {
+	// how many hosts to track per each host row displayed
+	// the more, the smaller the top-K errors
+	const size_t	HOSTS_TOPK_FACTOR = 4;
+	// hosts tracked per process even when the rows
+	// are not limited, keeps memory bounded on scans
+	const size_t	MIN_HOSTS_TRACKED = 256;
+	// minimum packets per thread to bind in parallel
+	const size_t	MIN_SHARD_PKTS = 1024;
+	// packets kept aside to retry against the next snapshot,
+	// beyond this they get dropped
+	const size_t	MAX_UNMAPPED = 262144;
 
-		const nettop::packet_stats	ps;
-		const type			t;
+	// first port of the local ephemeral range
+	uint16_t get_ephemeral_min(void) {
+		int		e_min = 32768;
+		std::ifstream	istr("/proc/sys/net/ipv4/ip_local_port_range");
+		istr >> e_min;
+		return (e_min > 0 && e_min < 65536) ? e_min : 32768;
+	}
 
-		log_evt(const nettop::packet_stats& ps_, const enum type t_) : ps(ps_), t(t_) {
-		}
+	inline size_t hosts_topk(void) {
+		return std::max(MIN_HOSTS_TRACKED, nettop::settings::LIMIT_HOSTS_ROWS*HOSTS_TOPK_FACTOR);
+	}
 
-		virtual std::string log(nettop::name_res& nr) const {
-			std::ostringstream	oss;
-			switch(t) {
-				case type::UNDET:
-					oss << "UNDET  :";
-					break;
-				case type::UNMAP_R:
-					oss << "UNMAP_R:";
-					break;
-				case type::UNMAP_S:
-					oss << "UNMAP_S:";
-					break;
-			}
-			oss << nr.to_str(ps.src) << ":" << ps.p_src << " --> " << nr.to_str(ps.dst) << ":" << ps.p_dst;
-			return oss.str();
-		}
-	};
+	inline uint16_t collapse_port(const uint16_t port) {
+		static const uint16_t	e_min = get_ephemeral_min();
+		return (nettop::settings::COLLAPSE_EPHEMERAL && port >= e_min) ? 0 : port;
+	}
+}
+
+nettop::proc_mgr::proc_acc::proc_acc() : addr_rs_map(hosts_topk()), conn_rs_map(hosts_topk()), total_rs(std::pair<size_t, size_t>(0, 0)) {
+}
 
-	nettop::sp_async_line gen_log(const nettop::packet_stats& ps, const enum log_evt::type t) {
-		return nettop::sp_async_line(new log_evt(ps, t));
+void nettop::proc_mgr::proc_acc::add(const packet_stats& p, const bool recv, const prefix_agg* agg) {
+	proc_stats::st	cur_stats;
+	if(recv) {
+		total_rs.first += p.len;
+		cur_stats.recv = p.len;
+	} else {
+		total_rs.second += p.len;
+		cur_stats.sent = p.len;
+	}
+	switch(p.t) {
+		case packet_stats::type::PACKET_TCP:
+			cur_stats.tcp_t = p.len;
+			break;
+		case packet_stats::type::PACKET_UDP:
+			cur_stats.udp_t = p.len;
+			break;
 	}
+	const addr_t&	host = recv ? p.src : p.dst;
+	hosts.add(host.hash());
+	addr_rs_map.add(agg ? agg->map(host) : host, cur_stats);
+	if(settings::BREAKDOWN) {
+		const conn_key	ck = recv ? conn_key(p.src, collapse_port(p.p_src), collapse_port(p.p_dst), p.t) : conn_key(p.dst, collapse_port(p.p_dst), collapse_port(p.p_src), p.t);
+		conn_rs_map.add(ck, cur_stats);
+	}
+}
+
+void nettop::proc_mgr::proc_acc::merge(const proc_acc& rhs) {
+	total_rs.first += rhs.total_rs.first;
+	total_rs.second += rhs.total_rs.second;
+	addr_rs_map.merge(rhs.addr_rs_map);
+	conn_rs_map.merge(rhs.conn_rs_map);
+	hosts.merge(rhs.hosts);
 }
 
-nettop::proc_mgr::proc_mgr() {
+void nettop::proc_mgr::stats::merge(const stats& rhs) {
+	total_pkts += rhs.total_pkts;
+	proc_pkts += rhs.proc_pkts;
+	undet_pkts += rhs.undet_pkts;
+	unmap_r_pkts += rhs.unmap_r_pkts;
+	unmap_s_pkts += rhs.unmap_s_pkts;
+	drop_pkts += rhs.drop_pkts;
+	if(rhs.min_ts >= 0.0 && (min_ts < 0.0 || min_ts > rhs.min_ts))
+		min_ts = rhs.min_ts;
+	if(rhs.max_ts >= 0.0 && (max_ts < 0.0 || max_ts < rhs.max_ts))
+		max_ts = rhs.max_ts;
+}
+
+nettop::proc_mgr::proc_mgr() : next_(0) {
+	// sockets found in /proc are valid from about now
+	timeval		tv;
+	gettimeofday(&tv, 0);
+	ts_ = tv_to_sec(tv);
 	// get all the links between ext_sd --> inode
 	m_inodes	inodes_link;
 	get_all_sockets(inodes_link);
@@ -257,32 +305,88 @@ nettop::proc_mgr::proc_mgr() {
 		p_map_[proc_info(pid, cmd_line, sds)];
     	}
     	closedir(dir);
-}
-
-//#include <iostream>
-
-void nettop::proc_mgr::bind_packets(const std::list<packet_stats>& p_list, const local_addr_mgr& lam, ps_vec& out, stats& st, async_log_list& log_list) {
 	// create a utility map from port/proto/ipv --> pid
-	std::map<ext_sd, proc_map::iterator>	sd_pid_map;
+	// this is built once per snapshot and reused for all batches
 	for(proc_map::iterator it = p_map_.begin(); it != p_map_.end(); ++it) {
-		//std::cout << it->first.pid << "(" << it->first.cmd << ")\t";
 		for(const auto& i : it->first.sd_v) {
-			//std::cout << "(" << i.t << ")" << i.addr.to_str() << ":" << i.port << "\t";
-			if(sd_pid_map.end() != sd_pid_map.find(i)) {
-				//std::cout << __FUNCTION__ << " " << i.addr.to_str() << ":" << i.port << "(" << i.t << ") local address is already mapped to another process!" << std::endl;
+			// local address could be already mapped to another process
+			if(sd_pid_map_.end() != sd_pid_map_.find(i))
 				continue;
-			}
-			sd_pid_map[i] = it;
+			sd_pid_map_[i] = it;
 		}
-		//std::cout << std::endl;
 	}
 	// Identify the process 0 (as kernel). All unmapped packet will go there...
-	proc_map::iterator	it_kernel = p_map_.find(proc_info(-1, "(kernel)", sd_vec()));
-	if(it_kernel == p_map_.end()) {
-		it_kernel = p_map_.insert(std::make_pair<proc_info, std::pair<ps_list, ps_list> >(proc_info(-1, "(kernel)", sd_vec()), std::pair<ps_list, ps_list>())).first;
+	it_kernel_ = p_map_.insert(std::make_pair(proc_info(-1, "(kernel)", sd_vec()), proc_acc())).first;
+}
+
+const nettop::proc_mgr::proc_map::iterator* nettop::proc_mgr::find_proc(const addr_t& addr, const int port, const enum packet_stats::type t) const {
+	auto 	it = sd_pid_map_.find(ext_sd(addr, port, t));
+	if(it == sd_pid_map_.end()) {
+		// last resort, if we can't find it, we should try with the default ANY address (0.0.0.0)
+		it = sd_pid_map_.find(ext_sd(addr_t(addr.get_af_type()), port, t));
+		if(it == sd_pid_map_.end())
+			return 0;
+	}
+	return &it->second;
+}
+
+const nettop::proc_mgr::proc_map::iterator* nettop::proc_mgr::find_gen(const addr_t& addr, const int port, const enum packet_stats::type t, const double ts) const {
+	// a packet most likely belongs to a socket of the snapshot taken
+	// right before it has been captured, then of the closest ones
+	const proc_mgr	*gens[3] = { this, next_, prev_.get() };
+	if(next_ && ts >= next_->ts_) {
+		gens[0] = next_;
+		gens[1] = this;
+	} else if(prev_ && ts < ts_) {
+		gens[0] = prev_.get();
+		gens[1] = this;
+		gens[2] = next_;
 	}
-	// first assign packets to processes
-	for(const auto& i : p_list) {
+	for(const auto g : gens) {
+		if(!g)
+			continue;
+		const proc_map::iterator	*it = g->find_proc(addr, port, t);
+		if(it)
+			return it;
+	}
+	return 0;
+}
+
+void nettop::proc_mgr::attribute(const packet_stats& i, const bool recv, bind_acc& acc, const bool log, const prefix_agg* agg, const pcap_export* pe, const bool defer) const {
+	const proc_map::iterator	*p_it = recv ? find_gen(i.dst, i.p_dst, i.t, i.ts) : find_gen(i.src, i.p_src, i.t, i.ts);
+	if(!p_it) {
+		// the socket may show up only in the next snapshot; each
+		// shard stops early, merge_acc enforces the cap overall
+		if(defer) {
+			if(unmapped_.size() + acc.unmapped.size() < MAX_UNMAPPED)
+				acc.unmapped.push_back(std::make_pair(i, recv));
+			else
+				++acc.st.drop_pkts;
+			return;
+		}
+		if(log)
+			acc.flows.add(i, recv ? log_rec::type::UNMAP_R : log_rec::type::UNMAP_S);
+		if(pe)
+			pcap_export::append(acc.pe_recs, i, recv ? pcap_export::UNMAP_R : pcap_export::UNMAP_S);
+		if(recv)
+			++acc.st.unmap_r_pkts;
+		else
+			++acc.st.unmap_s_pkts;
+		acc.procs[&it_kernel_->first].add(i, recv, agg);
+		return;
+	}
+	const proc_info&	pi = (*p_it)->first;
+	if(pe && pe->want_pid(pi.pid))
+		pcap_export::append(acc.pe_recs, i, recv ? pcap_export::PROC_R : pcap_export::PROC_S, pi.pid, &pi.cmd);
+	acc.procs[&pi].add(i, recv, agg);
+	++acc.st.proc_pkts;
+}
+
+void nettop::proc_mgr::bind_range(std::vector<packet_stats>::const_iterator it, const std::vector<packet_stats>::const_iterator it_end, const local_addr_mgr& lam, bind_acc& acc, const bool log, hosts_sketch* hs, const prefix_agg* agg, const pcap_export* pe) const {
+	stats&				st = acc.st;
+	const local_addr_mgr::set_ptr	local = lam.get();
+	for(; it != it_end; ++it) {
+		const packet_stats&	i = *it;
 		// refresh timestamp stats - this is a coarse measurement
 		if(st.min_ts < 0.0 || st.min_ts > i.ts)
 			st.min_ts = i.ts;
@@ -292,79 +396,112 @@ void nettop::proc_mgr::bind_packets(const std::list<packet_stats>& p_list, const
 		// the kernel should be smart enough to let them "live" on shared memory only when those are
 		// localhost --> localhost...
 		if(i.dst == i.src)
-			continue; 
-		const bool	is_recv = lam.is_local(i.dst),
-				is_sent = lam.is_local(i.src);
+			continue;
+		const bool	is_recv = local->contains(i.dst),
+				is_sent = local->contains(i.src);
 		if(!(is_recv ^ is_sent)) {
-			log_list.push(gen_log(i, log_evt::type::UNDET));
+			if(log)
+				acc.flows.add(i, log_rec::type::UNDET);
+			if(pe)
+				pcap_export::append(acc.pe_recs, i, pcap_export::UNDET);
 			++st.undet_pkts;
 			continue;
 		}
 		// from this point we're sure about a packet has been sent or received...
-		if(is_recv && (settings::CAPTURE_ASR & CAPTURE_RECV)) {
-			const ext_sd	cur_sd(i.dst, i.p_dst, i.t);
-			auto 		it = sd_pid_map.find(cur_sd);
-			if(it == sd_pid_map.end()) {
-				// last resort, if we can't find it, we should try with the default ANY address (0.0.0.0)
-				const ext_sd	cur_sd_ANY(addr_t(i.dst.get_af_type()), i.p_dst, i.t);
-				it = sd_pid_map.find(cur_sd_ANY);
-				if(it == sd_pid_map.end()) {
-					log_list.push(gen_log(i, log_evt::type::UNMAP_R));
-					++st.unmap_r_pkts;
-					it_kernel->second.first.push_back(i);
-					continue;
-				}
-			}
-			it->second->second.first.push_back(i);
-		} else if(settings::CAPTURE_ASR & CAPTURE_SEND) {
-			const ext_sd	cur_sd(i.src, i.p_src, i.t);
-			auto 		it = sd_pid_map.find(cur_sd);
-			if(it == sd_pid_map.end()) {
-				// last resort, if we can't find it, we should try with the default ANY address (0.0.0.0)
-				const ext_sd	cur_sd_ANY(addr_t(i.src.get_af_type()), i.p_src, i.t);
-				it = sd_pid_map.find(cur_sd_ANY);
-				if(it == sd_pid_map.end()) {
-					log_list.push(gen_log(i, log_evt::type::UNMAP_S));
-					++st.unmap_s_pkts;
-					it_kernel->second.second.push_back(i);
-					continue;
-				}
-			}
-			it->second->second.second.push_back(i);
+		if(hs)
+			hs->add(agg ? agg->map(is_recv ? i.src : i.dst) : (is_recv ? i.src : i.dst), i.len);
+		// packets of a direction which isn't captured are
+		// not attributed, but still count as processed
+		const bool	recv = is_recv && (settings::CAPTURE_ASR & CAPTURE_RECV);
+		if(!recv && !(settings::CAPTURE_ASR & CAPTURE_SEND)) {
+			++st.proc_pkts;
+			continue;
 		}
-		++st.proc_pkts;
+		attribute(i, recv, acc, log, agg, pe, true);
 	}
-	// now prepare output structure
-	out.reserve(p_map_.size());
-	for(const auto& i : p_map_) {
-		proc_stats	ps(i.first.pid, i.first.cmd);
-		for(const auto& r : i.second.first) {
-			ps.total_rs.first += r.len;
-			proc_stats::st& cur_stats = ps.addr_rs_map[r.src];
-			cur_stats.recv += r.len;
-			switch(r.t) {
-				case packet_stats::type::PACKET_TCP:
-					cur_stats.tcp_t += r.len;
-					break;
-				case packet_stats::type::PACKET_UDP:
-					cur_stats.udp_t += r.len;
-					break;
-			} 
-		}
-		for(const auto& r : i.second.second) {
-			ps.total_rs.second += r.len;
-			proc_stats::st& cur_stats = ps.addr_rs_map[r.dst];
-			cur_stats.sent += r.len;
-			switch(r.t) {
-				case packet_stats::type::PACKET_TCP:
-					cur_stats.tcp_t += r.len;
-					break;
-				case packet_stats::type::PACKET_UDP:
-					cur_stats.udp_t += r.len;
-					break;
-			}
+}
+
+void nettop::proc_mgr::merge_acc(bind_acc& acc, stats& st, log_flows* flows, pcap_export* pe) {
+	st.merge(acc.st);
+	if(flows)
+		flows->merge(acc.flows);
+	if(pe)
+		pe->add(acc.pe_recs);
+	for(const auto& i : acc.unmapped) {
+		if(unmapped_.size() >= MAX_UNMAPPED) {
+			++st.drop_pkts;
+			continue;
 		}
-		out.push_back(ps);
+		unmapped_.push_back(i);
 	}
+	// processes only in the previous snapshot get added to this one
+	for(const auto& i : acc.procs)
+		p_map_[*i.first].merge(i.second);
 }
 
+void nettop::proc_mgr::bind_parallel(const std::vector<packet_stats>& p_list, const local_addr_mgr& lam, stats& st, log_flows* flows, hosts_sketch* hs, thread_pool& tp, const prefix_agg* agg, pcap_export* pe) {
+	const size_t	n_shards = tp.size(),
+			shard_sz = p_list.size()/n_shards;
+	// split the list in contiguous ranges
+	std::vector<ps_batch::const_iterator>	bounds;
+	bounds.reserve(n_shards+1);
+	for(size_t i = 0; i < n_shards; ++i)
+		bounds.push_back(p_list.begin() + i*shard_sz);
+	bounds.push_back(p_list.end());
+	// bind each range in its own accumulators
+	std::vector<bind_acc>	shards(n_shards);
+	tp.run(n_shards, [&](const size_t i) {
+		bind_range(bounds[i], bounds[i+1], lam, shards[i], flows != 0, hs ? &hs->get_shard(i) : 0, agg, pe);
+	});
+	// then merge all of them, in order so that
+	// the exported packets stay sorted by time
+	if(hs)
+		hs->merge_shards();
+	for(auto& sa : shards)
+		merge_acc(sa, st, flows, pe);
+}
+
+void nettop::proc_mgr::set_prev(const std::shared_ptr<proc_mgr>& prev) {
+	prev_ = prev;
+	// we only keep two generations
+	if(prev_) {
+		prev_->prev_.reset();
+		prev_->next_ = 0;
+	}
+}
+
+void nettop::proc_mgr::set_next(const proc_mgr* next) {
+	next_ = next;
+}
+
+void nettop::proc_mgr::bind_packets(const std::vector<packet_stats>& p_list, const local_addr_mgr& lam, stats& st, log_flows* flows, hosts_sketch* hs, thread_pool* tp, const prefix_agg* agg, pcap_export* pe) {
+	// small batches are not worth splitting
+	if(tp && tp->size() > 1 && p_list.size() >= tp->size()*MIN_SHARD_PKTS) {
+		bind_parallel(p_list, lam, st, flows, hs, *tp, agg, pe);
+		return;
+	}
+	bind_acc	acc;
+	bind_range(p_list.begin(), p_list.end(), lam, acc, flows != 0, hs, agg, pe);
+	merge_acc(acc, st, flows, pe);
+}
+
+void nettop::proc_mgr::bind_unmapped(stats& st, log_flows* flows, const prefix_agg* agg, pcap_export* pe) {
+	bind_acc	acc;
+	for(const auto& i : unmapped_)
+		attribute(i.first, i.second, acc, flows != 0, agg, pe, false);
+	unmapped_.clear();
+	merge_acc(acc, st, flows, pe);
+}
+
+void nettop::proc_mgr::get_stats(ps_vec& out) {
+	out.reserve(out.size() + p_map_.size());
+	for(auto& i : p_map_) {
+		out.push_back(proc_stats(i.first.pid, i.first.cmd));
+		out.back().addr_rs_map.swap(i.second.addr_rs_map);
+		out.back().conn_rs_map.swap(i.second.conn_rs_map);
+		out.back().total_rs = i.second.total_rs;
+		i.second.total_rs = std::pair<size_t, size_t>(0, 0);
+		out.back().n_hosts = i.second.hosts.estimate();
+		i.second.hosts = hll();
+	}
+}
@@ -22,12 +22,18 @@
 
 #include <sys/types.h>
 #include <map>
-#include <list>
+#include <unordered_map>
 #include <vector>
 #include <memory>
 #include "packet_stats.h"
 #include "async_log.h"
 #include "name_res.h"
+#include "topk_map.h"
+#include "hll.h"
+#include "hosts_sketch.h"
+#include "thread_pool.h"
+#include "prefix_agg.h"
+#include "pcap_export.h"
 
 namespace nettop {
 
@@ -56,6 +62,28 @@ namespace nettop {
 
 	typedef std::vector<ext_sd>	sd_vec;
 
+	// compact key of a connection, seen from the process
+	// ports set to 0 are the collapsed ephemeral ones
+	struct conn_key {
+		addr_t		addr;
+		uint16_t	r_port,
+				l_port;
+		uint8_t		t;
+
+		conn_key(const addr_t& addr_ = addr_t(), const uint16_t r_port_ = 0, const uint16_t l_port_ = 0, const uint8_t t_ = packet_stats::type::PACKET_TCP) : addr(addr_), r_port(r_port_), l_port(l_port_), t(t_) {
+		}
+
+		inline bool operator==(const conn_key& rhs) const {
+			return r_port == rhs.r_port && l_port == rhs.l_port && t == rhs.t && addr == rhs.addr;
+		}
+	};
+
+	struct conn_key_hash {
+		size_t operator()(const conn_key& k) const {
+			return k.addr.hash() ^ ((((uint64_t)k.r_port << 24) | ((uint64_t)k.l_port << 8) | k.t) * 0x9e3779b97f4a7c15ULL);
+		}
+	};
+
 	class proc_info {
 
 		proc_info& operator=(const proc_info&) = delete;
@@ -85,47 +113,156 @@ namespace nettop {
 			size_t	recv,
 				sent,
 				udp_t,
-				tcp_t;
+				tcp_t,
+				err;	// max bytes possibly not accounted (top-K)
+
+			st() : recv(0), sent(0), udp_t(0), tcp_t(0), err(0) {
+			}
+
+			size_t weight(void) const {
+				return recv + sent;
+			}
 
-			st() : recv(0), sent(0), udp_t(0), tcp_t(0) {
+			st& operator+=(const st& rhs) {
+				recv += rhs.recv;
+				sent += rhs.sent;
+				udp_t += rhs.udp_t;
+				tcp_t += rhs.tcp_t;
+				return *this;
 			}
 		};
 
-		typedef std::map<addr_t, st>	addr_st_map;
+		typedef topk_map<addr_t, st, std::unordered_map<addr_t, size_t> >			addr_st_map;
+		typedef topk_map<conn_key, st, std::unordered_map<conn_key, size_t, conn_key_hash> >	conn_st_map;
 	
 		pid_t				pid;
 		std::string			cmd;
 		addr_st_map			addr_rs_map;
+		conn_st_map			conn_rs_map;	// only with breakdown
 		std::pair<size_t, size_t>	total_rs;
+		// distinct remote addresses, estimated; not bounded
+		// by the top-K nor merged by the aggregation
+		size_t				n_hosts;
+		// bytes/s over the chosen window, hosts are in addr_rs_map order
+		std::pair<double, double>			rate_rs;
+		std::vector<std::pair<double, double> >	addr_rates;
 		
-		proc_stats(const pid_t pid_, const std::string& cmd_) : pid(pid_), cmd(cmd_), total_rs(std::pair<size_t, size_t>(0, 0)) {
+		proc_stats(const pid_t pid_, const std::string& cmd_) : pid(pid_), cmd(cmd_), total_rs(std::pair<size_t, size_t>(0, 0)), n_hosts(0), rate_rs(std::pair<double, double>(0.0, 0.0)) {
 		}
 	};
 
 	typedef std::vector<proc_stats>	ps_vec;
 
 	class proc_mgr {
-		typedef std::list<packet_stats>					ps_list;
-		typedef std::map<proc_info, std::pair<ps_list, ps_list> >	proc_map;
+		proc_mgr(const proc_mgr&) = delete;
+		proc_mgr& operator=(const proc_mgr&) = delete;
+
+		typedef std::vector<packet_stats>	ps_batch;
+		// packets without a socket yet, with their direction
+		typedef std::vector<std::pair<packet_stats, bool> >	unmap_vec;
+
+		// running totals of a process
+		struct proc_acc {
+			proc_stats::addr_st_map		addr_rs_map;
+			proc_stats::conn_st_map		conn_rs_map;
+			std::pair<size_t, size_t>	total_rs;
+			hll				hosts;
+
+			proc_acc();
 
-		proc_map	p_map_;
+			// adds a packet to the running totals, remote hosts
+			// are aggregated when agg is set
+			void add(const packet_stats& p, const bool recv, const prefix_agg* agg);
+
+			void merge(const proc_acc& rhs);
+		};
+
+		typedef std::map<proc_info, proc_acc>		proc_map;
+		typedef std::map<ext_sd, proc_map::iterator>	sd_map;
 	public:
 		struct stats {
 			size_t	total_pkts,
 				proc_pkts,
 				undet_pkts,
 				unmap_r_pkts,
-				unmap_s_pkts;
+				unmap_s_pkts,
+				drop_pkts;
 			double	min_ts,
 				max_ts;
 
-			stats() : total_pkts(0), proc_pkts(0), undet_pkts(0), unmap_r_pkts(0), unmap_s_pkts(0), min_ts(-1.0), max_ts(-1.0) {
+			stats() : total_pkts(0), proc_pkts(0), undet_pkts(0), unmap_r_pkts(0), unmap_s_pkts(0), drop_pkts(0), min_ts(-1.0), max_ts(-1.0) {
 			}
+
+			void merge(const stats& rhs);
 		};
+	private:
+		// accumulators of a single binding thread, either the serial
+		// one or a shard, keyed on the process of either snapshot
+		struct bind_acc {
+			std::map<const proc_info*, proc_acc>	procs;
+			stats					st;
+			log_flows				flows;
+			pcap_export::rec_vec			pe_recs;
+			unmap_vec				unmapped;
+		};
+
+		proc_map			p_map_;
+		sd_map				sd_pid_map_;
+		proc_map::iterator		it_kernel_;
+		double				ts_;
+		std::shared_ptr<proc_mgr>	prev_;
+		// not owned, only set at the end of the interval
+		const proc_mgr*			next_;
+		// packets which didn't match any socket so far
+		unmap_vec			unmapped_;
+
+		const proc_map::iterator* find_proc(const addr_t& addr, const int port, const enum packet_stats::type t) const;
+
+		const proc_map::iterator* find_gen(const addr_t& addr, const int port, const enum packet_stats::type t, const double ts) const;
 
+		// attributes a single packet to its process; when defer is set
+		// packets without a socket are kept aside instead of going
+		// to the kernel
+		void attribute(const packet_stats& i, const bool recv, bind_acc& acc, const bool log, const prefix_agg* agg, const pcap_export* pe, const bool defer) const;
+
+		// the only place where packets get attributed, both for the
+		// serial and the parallel paths; read only with respect to
+		// this object, can run concurrently
+		void bind_range(std::vector<packet_stats>::const_iterator it, const std::vector<packet_stats>::const_iterator it_end, const local_addr_mgr& lam, bind_acc& acc, const bool log, hosts_sketch* hs, const prefix_agg* agg, const pcap_export* pe) const;
+
+		// adds the accumulators to the running totals
+		void merge_acc(bind_acc& acc, stats& st, log_flows* flows, pcap_export* pe);
+
+		void bind_parallel(const std::vector<packet_stats>& p_list, const local_addr_mgr& lam, stats& st, log_flows* flows, hosts_sketch* hs, thread_pool& tp, const prefix_agg* agg, pcap_export* pe);
+	public:
 		proc_mgr();
 
-		void bind_packets(const std::list<packet_stats>& p_list, const local_addr_mgr& lam, ps_vec& out, stats& st, async_log_list& log_list);
+		// packets are looked up in the previous snapshot too,
+		// so that sockets opened or closed around the time
+		// the snapshots were taken can still be attributed
+		void set_prev(const std::shared_ptr<proc_mgr>& prev);
+
+		// the snapshot which follows this one, looked up too; has
+		// to outlive the next calls to bind_packets and bind_unmapped
+		void set_next(const proc_mgr* next);
+
+		// attributes a batch of packets and adds them to the running totals
+		// and, when provided, to the global remote hosts sketch; when a
+		// thread pool is provided, big batches are split across its threads;
+		// when agg is provided, remote hosts are accounted by network;
+		// packets which can't be attributed are kept until bind_unmapped,
+		// up to a cap beyond which they count as dropped; pe gets the
+		// ones of the pid it wants
+		void bind_packets(const std::vector<packet_stats>& p_list, const local_addr_mgr& lam, stats& st, log_flows* flows, hosts_sketch* hs = 0, thread_pool* tp = 0, const prefix_agg* agg = 0, pcap_export* pe = 0);
+
+		// retries the packets which couldn't be attributed, the ones
+		// still without a socket go to the kernel, to flows, when
+		// provided, and to pe, when provided; to be called once
+		// at the end of the interval, after set_next
+		void bind_unmapped(stats& st, log_flows* flows, const prefix_agg* agg = 0, pcap_export* pe = 0);
+
+		// moves out the running totals of all processes (even the ones without traffic)
+		void get_stats(ps_vec& out);
 	};
 }
 
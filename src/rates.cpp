@@ -0,0 +1,146 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "rates.h"
+#include "settings.h"
+#include <cmath>
+#include <algorithm>
+
+namespace {
+	const double	WINDOW_SECS[2] = { 10.0, 60.0 },
+			EWMA_TAU_SECS = 10.0;
+	// how much the ring can grow beyond the slots
+	// needed at the regular refresh interval
+	const size_t	MAX_SLOTS_FACTOR = 8;
+}
+
+nettop::rate_hist::rate_hist(const size_t n_slots, const size_t max_slots) : ring_(n_slots), head_(0), max_slots_(max_slots), w_{ window(WINDOW_SECS[0]), window(WINDOW_SECS[1]) }, ewma_r_(0.0), ewma_s_(0.0), last_gen(0) {
+}
+
+void nettop::rate_hist::drop_oldest(window& w) {
+	const slot&	s = oldest(w);
+	w.recv -= s.recv;
+	w.sent -= s.sent;
+	w.secs -= s.secs;
+	--w.n;
+}
+
+void nettop::rate_hist::grow(void) {
+	// unroll the ring oldest first, so that head_
+	// and the windows sizes stay valid
+	std::vector<slot>	r(std::min(2*ring_.size(), max_slots_));
+	for(size_t i = 0; i < ring_.size(); ++i)
+		r[i] = ring_[(head_ + i) % ring_.size()];
+	head_ = ring_.size();
+	ring_.swap(r);
+}
+
+void nettop::rate_hist::push(const uint64_t recv, const uint64_t sent, const double secs) {
+	// the 60s window still needs all the slots
+	if(w_[1].n == ring_.size() && ring_.size() < max_slots_)
+		grow();
+	// the slot at head is going to be overwritten
+	for(auto& w : w_) {
+		if(w.n == ring_.size())
+			drop_oldest(w);
+	}
+	slot&	s = ring_[head_];
+	s.recv = recv;
+	s.sent = sent;
+	s.secs = secs;
+	head_ = (head_ + 1) % ring_.size();
+	for(auto& w : w_) {
+		w.recv += recv;
+		w.sent += sent;
+		w.secs += secs;
+		++w.n;
+		// keep at least the last interval
+		while(w.n > 1 && w.secs - oldest(w).secs >= w.max_secs)
+			drop_oldest(w);
+	}
+	if(secs > 0.0) {
+		const double	a = 1.0 - std::exp(-secs/EWMA_TAU_SECS);
+		ewma_r_ += a*(recv/secs - ewma_r_);
+		ewma_s_ += a*(sent/secs - ewma_s_);
+	}
+}
+
+void nettop::rate_hist::get(const rate_window rw, double& recv, double& sent) const {
+	recv = sent = 0.0;
+	switch(rw) {
+		case RATE_INSTANT: {
+			const slot&	s = ring_[(head_ + ring_.size() - 1) % ring_.size()];
+			if(s.secs > 0.0) {
+				recv = s.recv/s.secs;
+				sent = s.sent/s.secs;
+			}
+		} break;
+		case RATE_10S:
+		case RATE_60S: {
+			const window&	w = w_[(rw == RATE_10S) ? 0 : 1];
+			if(w.secs > 0.0) {
+				recv = w.recv/w.secs;
+				sent = w.sent/w.secs;
+			}
+		} break;
+		case RATE_EWMA:
+			recv = ewma_r_;
+			sent = ewma_s_;
+			break;
+	}
+}
+
+nettop::rates_mgr::rates_mgr() : n_slots_(2 + WINDOW_SECS[1]/((settings::REFRESH_SECS) ? settings::REFRESH_SECS : 1)), gen_(0) {
+}
+
+nettop::rate_hist& nettop::rates_mgr::push(const key& k, const uint64_t recv, const uint64_t sent, const double secs) {
+	hist_map::iterator	it = hists_.find(k);
+	if(it == hists_.end())
+		it = hists_.insert(std::make_pair(k, rate_hist(n_slots_, n_slots_*MAX_SLOTS_FACTOR))).first;
+	it->second.push(recv, sent, secs);
+	it->second.last_gen = gen_;
+	return it->second;
+}
+
+void nettop::rates_mgr::update(ps_vec& p_vec, const double secs, const rate_window rw) {
+	++gen_;
+	for(auto& p : p_vec) {
+		push(key(p.pid, addr_t()), p.total_rs.first, p.total_rs.second, secs).get(rw, p.rate_rs.first, p.rate_rs.second);
+		// rates are in the same order as the hosts entries
+		p.addr_rates.resize(p.addr_rs_map.size());
+		size_t	idx = 0;
+		for(const auto& h : p.addr_rs_map) {
+			std::pair<double, double>&	r = p.addr_rates[idx++];
+			push(key(p.pid, h.first), h.second.recv, h.second.sent, secs).get(rw, r.first, r.second);
+		}
+	}
+	// whatever has not been seen goes on with an empty interval
+	// until it has been idle for the longest window
+	for(hist_map::iterator it = hists_.begin(); it != hists_.end(); ) {
+		if(it->second.last_gen != gen_) {
+			it->second.push(0, 0, secs);
+			if(it->second.idle()) {
+				it = hists_.erase(it);
+				continue;
+			}
+		}
+		++it;
+	}
+}
@@ -0,0 +1,126 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _RATES_H_
+#define _RATES_H_
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "proc.h"
+
+namespace nettop {
+	enum rate_window {
+		RATE_INSTANT = 0,
+		RATE_10S,
+		RATE_60S,
+		RATE_EWMA
+	};
+
+	// Ring buffer of the totals of the last intervals, with
+	// running sums for the 10s and 60s windows so that adding
+	// an interval and reading any rate is O(1); windows are
+	// trimmed by time and the ring grows up to max_slots when
+	// shorter intervals (forced refreshes) don't cover 60s
+	class rate_hist {
+		struct slot {
+			uint64_t	recv,
+					sent;
+			double		secs;
+		};
+
+		struct window {
+			const double	max_secs;
+			size_t		n;
+			uint64_t	recv,
+					sent;
+			double		secs;
+
+			window(const double max_secs_) : max_secs(max_secs_), n(0), recv(0), sent(0), secs(0.0) {
+			}
+		};
+
+		std::vector<slot>	ring_;
+		size_t			head_,
+					max_slots_;
+		window			w_[2];
+		double			ewma_r_,
+					ewma_s_;
+
+		const slot& oldest(const window& w) const {
+			return ring_[(head_ + ring_.size() - w.n) % ring_.size()];
+		}
+
+		void drop_oldest(window& w);
+
+		void grow(void);
+	public:
+		size_t			last_gen;
+
+		rate_hist(const size_t n_slots, const size_t max_slots);
+
+		void push(const uint64_t recv, const uint64_t sent, const double secs);
+
+		// nothing seen within the last 60s
+		bool idle(void) const {
+			return !w_[1].recv && !w_[1].sent;
+		}
+
+		void get(const rate_window rw, double& recv, double& sent) const;
+	};
+
+	// Keeps the rate history of each process and of each of
+	// its remote hosts across refreshes
+	class rates_mgr {
+		struct key {
+			pid_t	pid;
+			addr_t	addr;	// addr_t() for the process itself
+
+			key(const pid_t pid_, const addr_t& addr_) : pid(pid_), addr(addr_) {
+			}
+
+			bool operator==(const key& rhs) const {
+				return pid == rhs.pid && addr == rhs.addr;
+			}
+		};
+
+		struct key_hash {
+			size_t operator()(const key& k) const {
+				return k.addr.hash() ^ ((uint64_t)k.pid * 0x9e3779b97f4a7c15ULL);
+			}
+		};
+
+		typedef std::unordered_map<key, rate_hist, key_hash>	hist_map;
+
+		const size_t	n_slots_;
+		hist_map	hists_;
+		size_t		gen_;
+
+		rate_hist& push(const key& k, const uint64_t recv, const uint64_t sent, const double secs);
+	public:
+		rates_mgr();
+
+		// adds the last interval and sets the rates of the
+		// given window into each process and host
+		void update(ps_vec& p_vec, const double secs, const rate_window rw);
+	};
+}
+
+#endif //_RATES_H_
@@ -36,9 +36,52 @@ namespace {
 				"    --tcp-udp-split\t\tDisplays split of TCP and UDP traffic in % (default not set)\n"
 				"-n, --no-resolve\t\tDo not resolve addresses, leave IPs to be displayed\n"
 				"-a, --async-log-file (file)\tSets an output file where to store the packets attribued to the 'kernel' (default not set)\n"
-				"-l, --limit-hosts-rows\t\tLimits maximum number of hosts rows per pid (default no limit)\n"
+				"-l, --limit-hosts-rows\t\tLimits maximum number of hosts rows per pid, the rest is shown as (other) (default no limit, at most the top 256 hosts are tracked)\n"
+				"    --global-hosts n\t\tShows a panel with the top 'n' remote hosts across all processes (default not set)\n"
+				"    --cms-width w\t\tWidth of the Count-Min sketch used for the global remote hosts (default " << CMS_WIDTH << ")\n"
+				"    --cms-depth d\t\tDepth of the Count-Min sketch used for the global remote hosts (default " << CMS_DEPTH << ")\n"
+				"    --cms-decay f\t\tFactor (0 to 0.99) applied to the global remote hosts sketch at each refresh (default " << CMS_DECAY << ")\n"
+				"    --bind-threads n\t\tNumber of threads binding packets to processes (default " << BIND_THREADS << ")\n"
+				"    --max-queued-pkts n\t\tPackets waiting to be bound before the new ones are dropped (default " << MAX_QUEUED_PKTS << ")\n"
+				"    --breakdown\t\t\tAlso tracks traffic per remote port and connection, press 'v' to switch view (default not set)\n"
+				"    --collapse-ephemeral\tCounts all the ephemeral ports as a single one in the breakdown (default not set)\n"
+				"    --sort-window (i|10|60|e)\tRates to sort and display, 'i'nstant, '10' or '60' seconds windows, 'e'wma (default 'i')\n"
+				"    --history f\t\t\tAppends the totals of each interval to the memory mapped history file f (default not set)\n"
+				"    --history-rows n\t\tNumber of rows kept when creating a new history file, older ones get overwritten; the\n"
+				"    \t\t\t\tfile has room for n/16 distinct cmdlines, at least 4096, which are never recycled (default 262144)\n"
+				"    --history-hosts\t\tAlso stores a row for each remote host in the history (default not set)\n"
+				"    --history-query q\t\tPrints the top talkers stored in the history file and exits, q is 'from[,to[,n]]'\n"
+				"    \t\t\t\twhere times are seconds since epoch, negative seconds from now, 'YYYY-mm-dd HH:MM[:SS]' or 'HH:MM[:SS]'\n"
+				"    --aggregate-prefix v4[,v6]\tAccounts remote hosts by network, with the given prefix lengths (e.g. 24,64), 0 keeps the addresses (default not set)\n"
+				"    --aggregate-cidr f\t\tAccounts remote hosts by the networks listed in file f, one 'cidr [name]' per line; these take precedence\n"
+				"    \t\t\t\tover --aggregate-prefix (default not set)\n"
+				"    --alert-rules f\t\tEvaluates the rules in file f at each refresh and writes alerts to the async log (-a), one\n"
+				"    \t\t\t\t'name (recv|sent|total|hosts) threshold [clear=value] [cmd=substring]' per line (default not set)\n"
+				"    --no-ui\t\t\tDoes not draw anything, useful with --alert-rules and -a, or --history (default not set)\n"
+				"    --batch (json|csv)\t\tDoes not draw anything and writes, at each refresh, one record per process, per remote\n"
+				"    \t\t\t\thost and for the totals, as JSON Lines or CSV (default not set)\n"
+				"    --batch-file f\t\tAppends the --batch records to file f instead of stdout (default not set)\n"
+				"    --resolve-threads n\t\tNumber of threads resolving host names concurrently (default 4)\n"
+				"    --resolve-timeout s\t\tSeconds after which a single DNS query gives up, 0 for the system setting (default 2)\n"
+				"    --resolve-server a\t\tSends the reverse lookups to the DNS server a, as 'ipv4[:port]', instead of the\n"
+				"    \t\t\t\tones of the system; /etc/hosts is still read first (default not set)\n"
+				"    --name-cache n\t\tMaximum number of host names kept, least recently used ones get dropped (default 16384)\n"
+				"    --name-ttl s\t\tSeconds after which a host name gets resolved again (default 600)\n"
+				"    --name-neg-ttl s\t\tSeconds after which a host without name gets resolved again (default 60)\n"
+				"    --name-cache-file f\t\tSaves the host names to file f every 5 minutes and on exit, and reads them\n"
+				"    \t\t\t\tback on startup while still valid (default not set)\n"
+				"    --async-log-binary\t\tWrites the async log as fixed size binary records, dropping the events\n"
+				"    \t\t\t\twhich don't fit the buffer instead of falling behind (default not set)\n"
+				"    --decode-log f\t\tPrints the binary async log f as text, resolving the host names unless -n\n"
+				"    \t\t\t\tis set and using --name-cache-file when set, then exits\n"
+				"    --pcap-export f\t\tWrites the packets attributed to the 'kernel' to the pcapng file f, as synthesized\n"
+				"    \t\t\t\tip and tcp/udp headers with the original length and a comment on the attribution (default not set)\n"
+				"    --pcap-pid p\t\tWith --pcap-export, also writes the packets of process p (default not set)\n"
+				"    --pcap-max-size m\t\tRotates the --pcap-export file after m MiB, keeping 4 old ones (default 64)\n"
+				"    --passive-dns\t\tNames hosts after the DNS responses seen in the captured traffic, before any\n"
+				"    \t\t\t\treverse lookup; works with -n too (default not set)\n"
 				"    --help\t\t\tprints this help and exit\n\n"
-				"Press 'q' or 'ESC' inside nettop to quit, 'SPACE' or 'p' to pause nettop\n"
+				"Press 'q' or 'ESC' inside nettop to quit, 'SPACE' or 'p' to pause nettop, 'v' to switch hosts/ports/connections view, 's' to show internal stats\n"
 		<< std::flush;
 	}
 }
@@ -53,6 +96,39 @@ namespace nettop {
 		bool		NO_RESOLVE = false;
 		std::string	ASYNC_LOG_FILE = "";
 		size_t		LIMIT_HOSTS_ROWS = 0;
+		size_t		GLOBAL_HOSTS_ROWS = 0;
+		size_t		CMS_WIDTH = 2048;
+		size_t		CMS_DEPTH = 4;
+		double		CMS_DECAY = 0.5;
+		size_t		BIND_THREADS = 1;
+		size_t		MAX_QUEUED_PKTS = 262144;
+		bool		BREAKDOWN = false;
+		bool		COLLAPSE_EPHEMERAL = false;
+		int		SORT_WINDOW = 0;
+		std::string	HISTORY_FILE = "";
+		size_t		HISTORY_ROWS = 262144;
+		bool		HISTORY_HOSTS = false;
+		std::string	HISTORY_QUERY = "";
+		size_t		AGG_V4_LEN = 0;
+		size_t		AGG_V6_LEN = 0;
+		std::string	AGG_CIDR_FILE = "";
+		std::string	ALERT_RULES_FILE = "";
+		bool		NO_UI = false;
+		int		BATCH_FORMAT = 0;
+		std::string	BATCH_FILE = "";
+		size_t		RESOLVE_THREADS = 4;
+		size_t		RESOLVE_TIMEOUT = 2;
+		std::string	RESOLVE_SERVER = "";
+		size_t		NAME_CACHE_SIZE = 16384;
+		size_t		NAME_TTL = 600;
+		size_t		NAME_NEG_TTL = 60;
+		bool		PASSIVE_DNS = false;
+		std::string	NAME_CACHE_FILE = "";
+		bool		ASYNC_LOG_BINARY = false;
+		std::string	DECODE_LOG_FILE = "";
+		std::string	PCAP_EXPORT_FILE = "";
+		int		PCAP_PID = -1;
+		size_t		PCAP_MAX_MB = 64;
 	}
 }
 
@@ -70,6 +146,38 @@ int nettop::parse_args(int argc, char *argv[], const char *prog, const char *ver
 		{"tcp-udp-split",	no_argument,	   0,	0},
 		{"async-log-file",	required_argument, 0,	'a'},
 		{"limit-hosts-rows",	required_argument, 0,	'l'},
+		{"global-hosts",	required_argument, 0,	0},
+		{"cms-width",		required_argument, 0,	0},
+		{"cms-depth",		required_argument, 0,	0},
+		{"cms-decay",		required_argument, 0,	0},
+		{"bind-threads",	required_argument, 0,	0},
+		{"max-queued-pkts",	required_argument, 0,	0},
+		{"breakdown",		no_argument,	   0,	0},
+		{"collapse-ephemeral",	no_argument,	   0,	0},
+		{"sort-window",		required_argument, 0,	0},
+		{"history",		required_argument, 0,	0},
+		{"history-rows",	required_argument, 0,	0},
+		{"history-hosts",	no_argument,	   0,	0},
+		{"history-query",	required_argument, 0,	0},
+		{"aggregate-prefix",	required_argument, 0,	0},
+		{"aggregate-cidr",	required_argument, 0,	0},
+		{"alert-rules",		required_argument, 0,	0},
+		{"no-ui",		no_argument,	   0,	0},
+		{"batch",		required_argument, 0,	0},
+		{"batch-file",		required_argument, 0,	0},
+		{"resolve-threads",	required_argument, 0,	0},
+		{"resolve-timeout",	required_argument, 0,	0},
+		{"resolve-server",	required_argument, 0,	0},
+		{"name-cache",		required_argument, 0,	0},
+		{"name-ttl",		required_argument, 0,	0},
+		{"name-neg-ttl",	required_argument, 0,	0},
+		{"passive-dns",		no_argument,	   0,	0},
+		{"name-cache-file",	required_argument, 0,	0},
+		{"async-log-binary",	no_argument,	   0,	0},
+		{"decode-log",		required_argument, 0,	0},
+		{"pcap-export",		required_argument, 0,	0},
+		{"pcap-pid",		required_argument, 0,	0},
+		{"pcap-max-size",	required_argument, 0,	0},
 		{0, 0, 0, 0}
 	};
 	
@@ -89,6 +197,107 @@ int nettop::parse_args(int argc, char *argv[], const char *prog, const char *ver
 				FILTER_ZERO = true;
 			} if(!std::strcmp("tcp-udp-split", long_options[option_index].name)) {
 				TCP_UDP_TRAFFIC = true;
+			} else if(!std::strcmp("global-hosts", long_options[option_index].name)) {
+				const int	g_res = std::atoi(optarg);
+				GLOBAL_HOSTS_ROWS = (g_res > 0) ? g_res : 0;
+			} else if(!std::strcmp("cms-width", long_options[option_index].name)) {
+				const int	w_res = std::atoi(optarg);
+				CMS_WIDTH = (w_res < 16) ? 16 : w_res;
+			} else if(!std::strcmp("cms-depth", long_options[option_index].name)) {
+				const int	d_res = std::atoi(optarg);
+				CMS_DEPTH = (d_res < 1) ? 1 : (d_res > 16) ? 16 : d_res;
+			} else if(!std::strcmp("cms-decay", long_options[option_index].name)) {
+				const double	d_res = std::atof(optarg);
+				CMS_DECAY = (d_res < 0.0) ? 0.0 : (d_res > 0.99) ? 0.99 : d_res;
+			} else if(!std::strcmp("bind-threads", long_options[option_index].name)) {
+				const int	t_res = std::atoi(optarg);
+				BIND_THREADS = (t_res < 1) ? 1 : (t_res > 256) ? 256 : t_res;
+			} else if(!std::strcmp("max-queued-pkts", long_options[option_index].name)) {
+				const int	q_res = std::atoi(optarg);
+				MAX_QUEUED_PKTS = (q_res < 1024) ? 1024 : q_res;
+			} else if(!std::strcmp("breakdown", long_options[option_index].name)) {
+				BREAKDOWN = true;
+			} else if(!std::strcmp("collapse-ephemeral", long_options[option_index].name)) {
+				COLLAPSE_EPHEMERAL = true;
+			} else if(!std::strcmp("sort-window", long_options[option_index].name)) {
+				if(!std::strcmp("i", optarg)) {
+					SORT_WINDOW = 0;
+				} else if(!std::strcmp("10", optarg)) {
+					SORT_WINDOW = 1;
+				} else if(!std::strcmp("60", optarg)) {
+					SORT_WINDOW = 2;
+				} else if(!std::strcmp("e", optarg)) {
+					SORT_WINDOW = 3;
+				} else {
+					throw runtime_error("Invalid sort window provided (expected 'i', '10', '60' or 'e' but found '") << optarg << "')";
+				}
+			} else if(!std::strcmp("history", long_options[option_index].name)) {
+				HISTORY_FILE = optarg;
+			} else if(!std::strcmp("history-rows", long_options[option_index].name)) {
+				const int	h_res = std::atoi(optarg);
+				HISTORY_ROWS = (h_res > 1024) ? h_res : 1024;
+			} else if(!std::strcmp("history-hosts", long_options[option_index].name)) {
+				HISTORY_HOSTS = true;
+			} else if(!std::strcmp("history-query", long_options[option_index].name)) {
+				HISTORY_QUERY = optarg;
+			} else if(!std::strcmp("aggregate-prefix", long_options[option_index].name)) {
+				const char	*v6_s = std::strchr(optarg, ',');
+				const int	v4_res = std::atoi(optarg),
+						v6_res = (v6_s) ? std::atoi(v6_s + 1) : 0;
+				if(v4_res < 0 || v4_res > 32 || v6_res < 0 || v6_res > 128)
+					throw runtime_error("Invalid aggregation prefix lengths (expected 'v4[,v6]' within 0-32 and 0-128 but found '") << optarg << "')";
+				AGG_V4_LEN = v4_res;
+				AGG_V6_LEN = v6_res;
+			} else if(!std::strcmp("aggregate-cidr", long_options[option_index].name)) {
+				AGG_CIDR_FILE = optarg;
+			} else if(!std::strcmp("alert-rules", long_options[option_index].name)) {
+				ALERT_RULES_FILE = optarg;
+			} else if(!std::strcmp("no-ui", long_options[option_index].name)) {
+				NO_UI = true;
+			} else if(!std::strcmp("batch", long_options[option_index].name)) {
+				if(!std::strcmp("json", optarg)) {
+					BATCH_FORMAT = 1;
+				} else if(!std::strcmp("csv", optarg)) {
+					BATCH_FORMAT = 2;
+				} else {
+					throw runtime_error("Invalid batch format provided (expected 'json' or 'csv' but found '") << optarg << "')";
+				}
+				NO_UI = true;
+			} else if(!std::strcmp("batch-file", long_options[option_index].name)) {
+				BATCH_FILE = optarg;
+			} else if(!std::strcmp("resolve-threads", long_options[option_index].name)) {
+				const int	t_res = std::atoi(optarg);
+				RESOLVE_THREADS = (t_res < 1) ? 1 : (t_res > 64) ? 64 : t_res;
+			} else if(!std::strcmp("resolve-timeout", long_options[option_index].name)) {
+				const int	t_res = std::atoi(optarg);
+				RESOLVE_TIMEOUT = (t_res < 0) ? 0 : (t_res > 30) ? 30 : t_res;
+			} else if(!std::strcmp("resolve-server", long_options[option_index].name)) {
+				RESOLVE_SERVER = optarg;
+			} else if(!std::strcmp("name-cache", long_options[option_index].name)) {
+				const int	c_res = std::atoi(optarg);
+				NAME_CACHE_SIZE = (c_res < 1) ? 1 : c_res;
+			} else if(!std::strcmp("name-ttl", long_options[option_index].name)) {
+				const int	t_res = std::atoi(optarg);
+				NAME_TTL = (t_res < 1) ? 1 : t_res;
+			} else if(!std::strcmp("name-neg-ttl", long_options[option_index].name)) {
+				const int	t_res = std::atoi(optarg);
+				NAME_NEG_TTL = (t_res < 1) ? 1 : t_res;
+			} else if(!std::strcmp("passive-dns", long_options[option_index].name)) {
+				PASSIVE_DNS = true;
+			} else if(!std::strcmp("name-cache-file", long_options[option_index].name)) {
+				NAME_CACHE_FILE = optarg;
+			} else if(!std::strcmp("async-log-binary", long_options[option_index].name)) {
+				ASYNC_LOG_BINARY = true;
+			} else if(!std::strcmp("decode-log", long_options[option_index].name)) {
+				DECODE_LOG_FILE = optarg;
+			} else if(!std::strcmp("pcap-export", long_options[option_index].name)) {
+				PCAP_EXPORT_FILE = optarg;
+			} else if(!std::strcmp("pcap-pid", long_options[option_index].name)) {
+				const int	p_res = std::atoi(optarg);
+				PCAP_PID = (p_res < 0) ? -1 : p_res;
+			} else if(!std::strcmp("pcap-max-size", long_options[option_index].name)) {
+				const int	m_res = std::atoi(optarg);
+				PCAP_MAX_MB = (m_res < 1) ? 1 : m_res;
 			} else if(!std::strcmp("help", long_options[option_index].name)) {
 				print_help(prog, version);
 				std::exit(0);
@@ -149,6 +358,9 @@ int nettop::parse_args(int argc, char *argv[], const char *prog, const char *ver
 		break;
              	}
 	}
+	// alerts are only written to the async log
+	if(!ALERT_RULES_FILE.empty() && ASYNC_LOG_FILE.empty())
+		throw runtime_error("Option --alert-rules requires an async log file (-a) where to write the alerts");
 
 	return optind;
 }
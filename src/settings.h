@@ -37,6 +37,39 @@ namespace nettop {
 		extern bool		NO_RESOLVE;
 		extern std::string	ASYNC_LOG_FILE;
 		extern size_t		LIMIT_HOSTS_ROWS;
+		extern size_t		GLOBAL_HOSTS_ROWS;
+		extern size_t		CMS_WIDTH;
+		extern size_t		CMS_DEPTH;
+		extern double		CMS_DECAY;
+		extern size_t		BIND_THREADS;
+		extern size_t		MAX_QUEUED_PKTS;
+		extern bool		BREAKDOWN;
+		extern bool		COLLAPSE_EPHEMERAL;
+		extern int		SORT_WINDOW;
+		extern std::string	HISTORY_FILE;
+		extern size_t		HISTORY_ROWS;
+		extern bool		HISTORY_HOSTS;
+		extern std::string	HISTORY_QUERY;
+		extern size_t		AGG_V4_LEN;
+		extern size_t		AGG_V6_LEN;
+		extern std::string	AGG_CIDR_FILE;
+		extern std::string	ALERT_RULES_FILE;
+		extern bool		NO_UI;
+		extern int		BATCH_FORMAT;
+		extern std::string	BATCH_FILE;
+		extern size_t		RESOLVE_THREADS;
+		extern size_t		RESOLVE_TIMEOUT;
+		extern std::string	RESOLVE_SERVER;
+		extern size_t		NAME_CACHE_SIZE;
+		extern size_t		NAME_TTL;
+		extern size_t		NAME_NEG_TTL;
+		extern bool		PASSIVE_DNS;
+		extern std::string	NAME_CACHE_FILE;
+		extern bool		ASYNC_LOG_BINARY;
+		extern std::string	DECODE_LOG_FILE;
+		extern std::string	PCAP_EXPORT_FILE;
+		extern int		PCAP_PID;
+		extern size_t		PCAP_MAX_MB;
 	}
 
 	int parse_args(int argc, char *argv[], const char *prog, const char *version);
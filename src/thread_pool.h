@@ -0,0 +1,107 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _THREAD_POOL_H_
+#define _THREAD_POOL_H_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace nettop {
+	// Fixed set of threads running the tasks of a single job
+	// at a time; the calling thread takes part in the job too
+	class thread_pool {
+		thread_pool(const thread_pool&) = delete;
+		thread_pool& operator=(const thread_pool&) = delete;
+
+		std::vector<std::thread>	thrds_;
+		std::mutex			mtx_;
+		std::condition_variable		cv_work_,
+						cv_done_;
+		std::function<void(size_t)>	fn_;
+		size_t				n_tasks_,
+						next_task_,
+						pending_,
+						gen_;
+		bool				exit_;
+
+		// runs the tasks of current job, needs the lock held
+		void do_tasks(std::unique_lock<std::mutex>& lk) {
+			while(next_task_ < n_tasks_) {
+				const size_t	idx = next_task_++;
+				lk.unlock();
+				fn_(idx);
+				lk.lock();
+				if(!--pending_)
+					cv_done_.notify_all();
+			}
+		}
+
+		void thread_proc(void) {
+			std::unique_lock<std::mutex>	lk(mtx_);
+			size_t				seen_gen = gen_;
+			while(true) {
+				cv_work_.wait(lk, [&](){ return exit_ || seen_gen != gen_; });
+				if(exit_)
+					break;
+				seen_gen = gen_;
+				do_tasks(lk);
+			}
+		}
+	public:
+		// n is the total number of threads, including the caller
+		explicit thread_pool(const size_t n) : n_tasks_(0), next_task_(0), pending_(0), gen_(0), exit_(false) {
+			for(size_t i = 1; i < n; ++i)
+				thrds_.push_back(std::thread(&thread_pool::thread_proc, this));
+		}
+
+		size_t size(void) const {
+			return thrds_.size() + 1;
+		}
+
+		// executes fn(0) ... fn(n_tasks-1) and waits for all of them
+		void run(const size_t n_tasks, const std::function<void(size_t)>& fn) {
+			std::unique_lock<std::mutex>	lk(mtx_);
+			fn_ = fn;
+			n_tasks_ = n_tasks;
+			next_task_ = 0;
+			pending_ = n_tasks;
+			++gen_;
+			cv_work_.notify_all();
+			do_tasks(lk);
+			cv_done_.wait(lk, [&](){ return !pending_; });
+		}
+
+		~thread_pool() {
+			{
+				std::lock_guard<std::mutex>	lg(mtx_);
+				exit_ = true;
+			}
+			cv_work_.notify_all();
+			for(auto& i : thrds_)
+				i.join();
+		}
+	};
+}
+
+#endif //_THREAD_POOL_H_
@@ -0,0 +1,143 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _TOPK_MAP_H_
+#define _TOPK_MAP_H_
+
+#include <vector>
+#include <map>
+#include <algorithm>
+
+namespace nettop {
+	// Keeps the K heaviest keys using the Space-Saving algorithm
+	// (Metwally et al.): when full, the lightest entry gets replaced
+	// and its weight is carried over as error of the new entry.
+	// V has to provide weight(), the err field and operator+=
+	// K == 0 means no bound, i.e. all keys are tracked exactly.
+	// Idx is the container mapping each key to its entry.
+	template<typename K, typename V, typename Idx = std::map<K, size_t> >
+	class topk_map {
+	public:
+		typedef std::pair<K, V>				value_type;
+		typedef std::vector<value_type>			entries;
+		typedef typename entries::const_iterator	const_iterator;
+	private:
+		size_t			k_;
+		entries			v_;	// min-heap on estimate when bounded
+		Idx			idx_;
+
+		static size_t estimate(const value_type& e) {
+			return e.second.weight() + e.second.err;
+		}
+
+		void swap_pos(const size_t a, const size_t b) {
+			std::swap(v_[a], v_[b]);
+			idx_[v_[a].first] = a;
+			idx_[v_[b].first] = b;
+		}
+
+		void sift_up(size_t p) {
+			while(p) {
+				const size_t	parent = (p-1)/2;
+				if(estimate(v_[parent]) <= estimate(v_[p]))
+					break;
+				swap_pos(p, parent);
+				p = parent;
+			}
+		}
+
+		void sift_down(size_t p) {
+			while(true) {
+				const size_t	l = 2*p+1,
+						r = l+1;
+				size_t		m = p;
+				if(l < v_.size() && estimate(v_[l]) < estimate(v_[m]))
+					m = l;
+				if(r < v_.size() && estimate(v_[r]) < estimate(v_[m]))
+					m = r;
+				if(m == p)
+					break;
+				swap_pos(p, m);
+				p = m;
+			}
+		}
+
+		void add_entry(const K& key, const V& delta) {
+			auto	it = idx_.find(key);
+			if(it != idx_.end()) {
+				v_[it->second].second += delta;
+				v_[it->second].second.err += delta.err;
+				if(k_)
+					sift_down(it->second);
+			} else if(!k_ || v_.size() < k_) {
+				idx_[key] = v_.size();
+				v_.push_back(value_type(key, delta));
+				if(k_)
+					sift_up(v_.size()-1);
+			} else {
+				// replace the lightest one, it's at the root
+				const size_t	min_est = estimate(v_[0]);
+				idx_.erase(v_[0].first);
+				v_[0] = value_type(key, delta);
+				v_[0].second.err += min_est;
+				idx_[key] = 0;
+				sift_down(0);
+			}
+		}
+	public:
+		explicit topk_map(const size_t k = 0) : k_(k) {
+			if(k_)
+				v_.reserve(k_);
+		}
+
+		void add(const K& key, const V& delta) {
+			add_entry(key, delta);
+		}
+
+		void merge(const topk_map& rhs) {
+			for(const auto& i : rhs.v_)
+				add_entry(i.first, i.second);
+		}
+
+		size_t size(void) const {
+			return v_.size();
+		}
+
+		bool empty(void) const {
+			return v_.empty();
+		}
+
+		const_iterator begin(void) const {
+			return v_.begin();
+		}
+
+		const_iterator end(void) const {
+			return v_.end();
+		}
+
+		void swap(topk_map& rhs) {
+			std::swap(k_, rhs.k_);
+			v_.swap(rhs.v_);
+			idx_.swap(rhs.idx_);
+		}
+	};
+}
+
+#endif //_TOPK_MAP_H_
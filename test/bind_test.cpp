@@ -0,0 +1,93 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// A socket opened after the processes snapshot of the interval has
+// been taken must still get its packets, and not the kernel.
+
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <memory>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "binder.h"
+#include "utils.h"
+
+namespace {
+	int	failed = 0;
+
+	void check(const bool cond, const char* what) {
+		std::printf("%s: %s\n", cond ? "ok" : "FAILED", what);
+		if(!cond)
+			++failed;
+	}
+
+	double now(void) {
+		timeval		tv;
+		gettimeofday(&tv, 0);
+		return nettop::tv_to_sec(tv);
+	}
+}
+
+int main(void) {
+	static volatile bool		quit = false;
+	nettop::local_addr_mgr		lam(quit);
+	nettop::packet_list		p_list(1024);
+	nettop::async_log_list		log_list;
+	nettop::binder			b(quit, p_list, lam, log_list);
+	// the binder took its first snapshot, now open the socket
+	const int	sd = socket(AF_INET, SOCK_DGRAM, 0);
+	sockaddr_in	sa = sockaddr_in();
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	socklen_t	sa_len = sizeof(sa);
+	if(sd < 0 || bind(sd, (sockaddr*)&sa, sizeof(sa)) || getsockname(sd, (sockaddr*)&sa, &sa_len)) {
+		std::perror("socket");
+		return 1;
+	}
+	in_addr		remote,
+			local;
+	inet_pton(AF_INET, "203.0.113.5", &remote);
+	inet_pton(AF_INET, "127.0.0.1", &local);
+	p_list.push(nettop::packet_stats(addr_t(remote), addr_t(local), 5353, ntohs(sa.sin_port), 1000, nettop::packet_stats::PACKET_UDP, now()));
+	// let the binder thread bind it against the first snapshot
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	nettop::ps_vec			out;
+	nettop::proc_mgr::stats		st;
+	nettop::hosts_sketch::hh_vec	top_hosts;
+	b.snapshot(std::shared_ptr<nettop::proc_mgr>(new nettop::proc_mgr()), out, st, top_hosts);
+	size_t		own_recv = 0,
+			kernel_recv = 0;
+	for(const auto& i : out) {
+		if(i.pid == getpid())
+			own_recv += i.total_rs.first;
+		else if(i.pid == -1)
+			kernel_recv += i.total_rs.first;
+	}
+	check(st.proc_pkts == 1, "packet attributed to a process");
+	check(st.unmap_r_pkts == 0, "no unmapped received packets");
+	check(own_recv == 1000, "bytes attributed to the socket owner");
+	check(kernel_recv == 0, "no bytes attributed to the kernel");
+	close(sd);
+	quit = true;
+	return failed ? 1 : 0;
+}
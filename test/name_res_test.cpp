@@ -0,0 +1,189 @@
+/*
+*	nettop (C) 2017-2020 E. Oriani, ema <AT> fastwebnet <DOT> it
+*
+*	This file is part of nettop.
+*
+*	nettop is free software: you can redistribute it and/or modify
+*	it under the terms of the GNU General Public License as published by
+*	the Free Software Foundation, either version 3 of the License, or
+*	(at your option) any later version.
+*
+*	nettop is distributed in the hope that it will be useful,
+*	but WITHOUT ANY WARRANTY; without even the implied warranty of
+*	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*	GNU General Public License for more details.
+*
+*	You should have received a copy of the GNU General Public License
+*	along with nettop.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Reverse lookups through name_res against a stub DNS server on
+// the loopback, which names 192.0.2.n as host-n.stub.test and
+// answers NXDOMAIN for 192.0.2.99.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "name_res.h"
+
+namespace {
+	int	failed = 0;
+
+	void check(const bool cond, const char* what) {
+		std::printf("%s: %s\n", cond ? "ok" : "FAILED", what);
+		if(!cond)
+			++failed;
+	}
+
+	class stub_dns {
+		volatile bool&		exit_;
+		int			sd_;
+		std::atomic<size_t>	queries_;
+		std::thread		thrd_;
+
+		// writes name as DNS labels, returns the bytes written
+		static size_t put_name(unsigned char* out, const std::string& name) {
+			size_t	n = 0,
+				start = 0;
+			while(start < name.size()) {
+				size_t	dot = name.find('.', start);
+				if(std::string::npos == dot)
+					dot = name.size();
+				out[n++] = dot - start;
+				std::memcpy(out + n, name.data() + start, dot - start);
+				n += dot - start;
+				start = dot + 1;
+			}
+			out[n++] = 0;
+			return n;
+		}
+
+		// the first label of the question, i.e. the last octet
+		static int host_id(const unsigned char* q, const size_t len) {
+			if(len < 14 || q[12] > 3)
+				return -1;
+			return std::atoi(std::string((const char*)q + 13, q[12]).c_str());
+		}
+
+		void thread_proc(void) {
+			unsigned char	buf[512];
+			while(!exit_) {
+				struct pollfd	pfd = { sd_, POLLIN, 0 };
+				if(poll(&pfd, 1, 100) <= 0)
+					continue;
+				sockaddr_in	from;
+				socklen_t	from_len = sizeof(from);
+				const ssize_t	len = recvfrom(sd_, buf, sizeof(buf), 0, (sockaddr*)&from, &from_len);
+				if(len < 12)
+					continue;
+				++queries_;
+				// end of the question: name, type and class
+				size_t		q_end = 12;
+				while(q_end < (size_t)len && buf[q_end])
+					q_end += buf[q_end] + 1;
+				q_end += 5;
+				if(q_end > (size_t)len)
+					continue;
+				const int	id = host_id(buf, len);
+				const bool	found = id >= 0 && id != 99;
+				buf[2] = 0x84 | (buf[2] & 0x01);	// response, authoritative
+				buf[3] = found ? 0x00 : 0x03;		// NXDOMAIN
+				buf[6] = 0;
+				buf[7] = found ? 1 : 0;
+				std::memset(buf + 8, 0, 4);
+				size_t		n = q_end;
+				if(found) {
+					const unsigned char	rr[] = { 0xc0, 0x0c, 0, 12, 0, 1, 0, 0, 0, 60 };
+					std::memcpy(buf + n, rr, sizeof(rr));
+					n += sizeof(rr);
+					const size_t	rd_len = put_name(buf + n + 2, "host-" + std::to_string(id) + ".stub.test");
+					buf[n] = rd_len >> 8;
+					buf[n+1] = rd_len & 0xff;
+					n += 2 + rd_len;
+				}
+				sendto(sd_, buf, n, 0, (const sockaddr*)&from, from_len);
+			}
+		}
+	public:
+		stub_dns(volatile bool& e) : exit_(e), sd_(socket(AF_INET, SOCK_DGRAM, 0)), queries_(0) {
+			sockaddr_in	sa = sockaddr_in();
+			sa.sin_family = AF_INET;
+			sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			bind(sd_, (const sockaddr*)&sa, sizeof(sa));
+			thrd_ = std::thread(&stub_dns::thread_proc, this);
+		}
+
+		int port(void) const {
+			sockaddr_in	sa;
+			socklen_t	sa_len = sizeof(sa);
+			getsockname(sd_, (sockaddr*)&sa, &sa_len);
+			return ntohs(sa.sin_port);
+		}
+
+		size_t queries(void) const {
+			return queries_;
+		}
+
+		~stub_dns() {
+			thrd_.join();
+			close(sd_);
+		}
+	};
+
+	addr_t test_addr(const int id) {
+		in_addr		a;
+		inet_pton(AF_INET, ("192.0.2." + std::to_string(id)).c_str(), &a);
+		return addr_t(a);
+	}
+
+	// polls to_str until the name isn't the address anymore
+	std::string wait_name(nettop::name_res& nr, const addr_t& a) {
+		std::string	name;
+		for(int i = 0; i < 50; ++i) {
+			name = nr.to_str(a);
+			if(name != a.to_str())
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		return name;
+	}
+}
+
+int main(void) {
+	static volatile bool	quit = false;
+	stub_dns		dns(quit);
+	{
+		nettop::name_res	nr(quit, false, 4, 1, 16384, 600, 60, "", "127.0.0.1:" + std::to_string(dns.port()));
+		// queue a few at once, so that the workers take batches
+		for(int i = 1; i <= 32; ++i)
+			nr.to_str(test_addr(i));
+		nr.to_str(test_addr(99));
+		check(wait_name(nr, test_addr(7)) == "host-7.stub.test", "name from the stub server");
+		bool	all = true;
+		for(int i = 1; i <= 32; ++i)
+			all &= wait_name(nr, test_addr(i)) == "host-" + std::to_string(i) + ".stub.test";
+		check(all, "all the queued names resolved");
+		for(int i = 0; i < 50 && !nr.get_stats().negative; ++i)
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		check(nr.get_stats().negative == 1, "NXDOMAIN counted as negative");
+		check(nr.to_str(test_addr(99)) == test_addr(99).to_str(), "NXDOMAIN keeps the address");
+		check(dns.queries() >= 33, "queries reached the stub server");
+		quit = true;
+	}
+	bool	thrown = false;
+	try {
+		nettop::name_res	nr(quit, false, 1, 1, 16384, 600, 60, "", "not-an-ip");
+	} catch(const std::exception&) {
+		thrown = true;
+	}
+	check(thrown, "invalid server rejected");
+	return failed ? 1 : 0;
+}